@@ -0,0 +1,180 @@
+#include "aot.h"
+#include "machine.h"
+
+/** chip8_aot_runner::chip8_aot_runner
+    Constructor of the class.
+
+    @param program const chip8_aot_program* translated rom to run
+*/
+chip8_aot_runner::chip8_aot_runner(const chip8_aot_program* program){
+
+  if(!program){
+    throw std::invalid_argument("No translated program given");
+  }
+
+  this->program = program;
+  this->mem = nullptr;
+  this->translated = 0;
+  this->interpreted = 0;
+
+  this->block_at.assign(DATA_MEMORY_SIZE, -1);
+  this->covered.assign(DATA_MEMORY_SIZE, 0);
+  this->valid.assign(program->count, 0);
+
+  for(uint32_t b = 0; b < program->count; b++){
+    const chip8_aot_block* block = &program->blocks[b];
+
+    this->block_at[block->addr] = b;
+    for(uint32_t i = block->addr; i < (uint32_t) block->addr + block->size && i < DATA_MEMORY_SIZE; i++)
+      this->covered[i] = 1;
+  }
+}
+
+/** chip8_aot_runner::~chip8_aot_runner
+    Destroyer of the class.
+    Stop observing the memory, if still attached to one.
+
+*/
+chip8_aot_runner::~chip8_aot_runner(){
+  if(this->mem) this->mem->set_observer(nullptr);
+}
+
+/** chip8_aot_runner::attach
+    Start running on a new memory. Only the blocks
+    whose bytes are the ones in the memory are used.
+
+    @param mem Memory* data memory to observe
+*/
+void chip8_aot_runner::attach(DataMemory* mem){
+
+  if(this->mem) this->mem->set_observer(nullptr);
+
+  this->mem = mem;
+  this->mem->set_observer(this);
+
+  for(uint32_t b = 0; b < this->program->count; b++){
+    const chip8_aot_block* block = &this->program->blocks[b];
+
+    uint32_t offset = block->addr - ROM_ADDRESS;
+    bool same = (block->addr >= ROM_ADDRESS && offset + block->size <= this->program->rom_size);
+
+    for(uint32_t i = 0; same && i < block->size; i++)
+      same = (mem->read(block->addr + i) == this->program->rom[offset + i]);
+
+    this->valid[b] = same;
+  }
+}
+
+/** chip8_aot_runner::run
+    Execute a given number of instructions with the same key state.
+    A block is run only if it fits in the instructions left,
+    otherwise its instructions are interpreted one at a time.
+    The blocks follow the legacy profile: a CPU set to another
+    one is run by its own interpreter instead.
+
+    @param cpu    chip8* CPU to run
+    @param mem    Memory* data memory
+    @param vmem   Memory* video memory
+    @param key    uint16_t mask with the pressed keys
+    @param cycles uint32_t number of instructions to execute
+*/
+void chip8_aot_runner::run(chip8* cpu, DataMemory* mem, VideoMemory* vmem, uint16_t key, uint32_t cycles){
+
+  if(cpu->get_quirks() != QUIRKS_LEGACY){
+    cpu->run(mem, vmem, key, cycles);
+    this->interpreted += cycles;
+    return;
+  }
+
+  if(this->mem != mem) this->attach(mem);
+
+  this->state.cpu  = cpu;
+  this->state.mem  = mem;
+  this->state.vmem = vmem;
+  this->state.key  = key;
+
+  while(cycles > 0){
+
+    uint16_t pc = chip8_aot::PC(cpu);
+    int32_t b = this->block_at[pc];
+
+    if(b >= 0 && this->valid[b] && this->program->blocks[b].length <= cycles){
+      this->state.code_written = false;
+
+      uint32_t executed = this->program->blocks[b].fn(&this->state);
+      this->translated += executed;
+      cycles -= executed;
+    }
+    else {
+      uint16_t IR = (mem->read(pc) << 8 | mem->read(pc + 1));
+      chip8_aot::execute(cpu, IR, mem, vmem, key);
+
+      this->interpreted++;
+      cycles--;
+    }
+  }
+}
+
+/** chip8_aot_runner::get_translated
+    Return the number of instructions executed by translated blocks
+
+    @return uint64_t number of instructions
+*/
+uint64_t chip8_aot_runner::get_translated(){
+  return this->translated;
+}
+
+/** chip8_aot_runner::get_interpreted
+    Return the number of instructions executed by the interpreter
+
+    @return uint64_t number of instructions
+*/
+uint64_t chip8_aot_runner::get_interpreted(){
+  return this->interpreted;
+}
+
+/** chip8_aot_runner::on_write
+    Called by the memory after each write. The blocks
+    using the bytes written are not run anymore.
+
+    @param addr uint16_t first address written
+    @param size uint32_t number of bytes written
+*/
+void chip8_aot_runner::on_write(uint16_t addr, uint32_t size){
+
+  uint32_t last = (addr + size > DATA_MEMORY_SIZE) ? DATA_MEMORY_SIZE : addr + size;
+
+  bool hit = false;
+  for(uint32_t i = addr; i < last && !hit; i++) hit = this->covered[i];
+  if(!hit) return;
+
+  for(uint32_t b = 0; b < this->program->count; b++){
+    const chip8_aot_block* block = &this->program->blocks[b];
+    if(block->addr < last && block->addr + block->size > addr) this->valid[b] = 0;
+  }
+
+  this->state.code_written = true;
+}
+
+/** chip8_aot_runner::on_detach
+    Called by the memory when it stops being observed.
+
+    @param mem const void* memory detaching the runner
+*/
+void chip8_aot_runner::on_detach(const void* mem){
+  if(this->mem == mem) this->mem = nullptr;
+}
+
+/** chip8_aot_runner::find
+    Get the translated program of a rom.
+
+    @param hash uint64_t FNV-1a hash of the bytes of the rom
+    @return const chip8_aot_program* program, nullptr if the rom was not translated
+*/
+const chip8_aot_program* chip8_aot_runner::find(uint64_t hash){
+
+  for(int i = 0; chip8_aot_programs[i]; i++)
+    if(chip8_aot_programs[i]->hash == hash) return chip8_aot_programs[i];
+
+  return nullptr;
+}
@@ -0,0 +1,130 @@
+#ifndef __AOT_H
+#define __AOT_H
+
+#include <stdint.h>
+#include <vector>
+#include "chip8.h"
+#include "memory.h"
+
+// Roms translated ahead of time to C++ by chip8_aotc.
+// The translator follows the control flow of a rom from ROM_ADDRESS,
+// through jumps, calls and skips, and cuts the code reached into basic
+// blocks, each one becoming a C++ function which executes its
+// instructions on the state of a chip8 CPU. The generated file is
+// compiled and linked with the core library; chip8_aot_runner then
+// runs a rom with its blocks, and executes with the interpreter
+// whatever was not translated: code reached only through Bnnn, and
+// blocks whose bytes were written since the rom was loaded.
+// The translated code follows the legacy quirks profile, the runner
+// leaves a CPU set to another profile to its own interpreter.
+
+// State shared by the runner and the blocks while running
+struct chip8_aot_state {
+  chip8*       cpu;
+  DataMemory*  mem;
+  VideoMemory* vmem;
+  uint16_t     key;
+
+  // Set when an instruction writes over translated code, so that the
+  // block writing it stops right after the instruction
+  bool         code_written;
+};
+
+// Function of a block: executes its instructions, leaves PC at the
+// next instruction to execute, and returns how many were executed
+typedef uint32_t (*chip8_aot_fn)(chip8_aot_state*);
+
+// Block of a translated rom
+struct chip8_aot_block {
+  uint16_t     addr;
+  uint16_t     size;
+  uint16_t     length;
+  chip8_aot_fn fn;
+};
+
+// Translated rom, with its bytes to check that the memory holds it
+struct chip8_aot_program {
+  const char*            name;
+  uint64_t               hash;
+  const uint8_t*         rom;
+  uint32_t               rom_size;
+  const chip8_aot_block* blocks;
+  uint32_t               count;
+};
+
+// Programs of the generated file, terminated by nullptr
+extern const chip8_aot_program* const chip8_aot_programs[];
+
+// Access of the generated code to the state of the CPU.
+// Everything is inline, so that the registers are read
+// and written directly by the code of the blocks.
+struct chip8_aot {
+  static uint8_t&  V(chip8* c, int r)  { return c->regs[r]; }
+  static uint16_t& I(chip8* c)         { return c->I; }
+  static uint16_t& PC(chip8* c)        { return c->PC; }
+  static uint8_t&  DT(chip8* c)        { return c->DT; }
+  static uint8_t&  ST(chip8* c)        { return c->ST; }
+  static uint8_t   random(chip8* c)    { return c->next_random() % 256; }
+
+  static void call(chip8* c, uint16_t nnn) { c->instr_2nnn_CALL(nnn); }
+  static void ret(chip8* c)                { c->instr_00EE_RET(); }
+
+  static void execute(chip8* c, uint16_t IR, DataMemory* mem, VideoMemory* vmem, uint16_t key){
+    c->execute(IR, mem, vmem, key);
+  }
+
+  static uint8_t opcode(uint16_t IR)   { return chip8::decode(IR); }
+};
+
+// Runs a translated rom on a CPU and its memories
+class chip8_aot_runner : public MemoryObserver {
+  const chip8_aot_program* program;
+
+  DataMemory* mem;
+
+  // Index of the block starting at each address, -1 if none
+  std::vector<int32_t> block_at;
+
+  // Addresses holding translated code, and blocks still matching the memory
+  std::vector<uint8_t> covered;
+  std::vector<uint8_t> valid;
+
+  chip8_aot_state state;
+
+  // Instructions executed by blocks, and by the interpreter
+  uint64_t translated;
+  uint64_t interpreted;
+
+  void attach(DataMemory*);
+
+public:
+                          chip8_aot_runner(const chip8_aot_program*);
+                          ~chip8_aot_runner();
+  void                    run(chip8*, DataMemory*, VideoMemory*, uint16_t, uint32_t);
+  uint64_t                get_translated();
+  uint64_t                get_interpreted();
+  void                    on_write(uint16_t, uint32_t) override;
+  void                    on_detach(const void*) override;
+
+  static const chip8_aot_program* find(uint64_t);
+  static uint64_t                 hash_rom(const uint8_t*, uint32_t);
+};
+
+/** chip8_aot_runner::hash_rom
+    Compute the FNV-1a hash identifying a rom.
+
+    @param rom  const uint8_t* bytes of the rom
+    @param size uint32_t number of bytes
+    @return uint64_t hash of the rom
+*/
+inline uint64_t chip8_aot_runner::hash_rom(const uint8_t* rom, uint32_t size){
+
+  uint64_t h = FNV_OFFSET;
+  for(uint32_t i = 0; i < size; i++){
+    h ^= rom[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+#endif // !__AOT_H
@@ -0,0 +1,197 @@
+#include "aot.h"
+#include "machine.h"
+#include "input_script.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// CPU and memories of one of the runs compared
+struct check_side {
+  chip8       cpu;
+  DataMemory  dmem;
+  VideoMemory vmem;
+
+  // Host time spent running the instructions
+  std::chrono::steady_clock::duration time;
+};
+
+/** init_side
+    Reset a CPU and its memories, and load the rom.
+
+    @param side check_side* run to reset
+    @param rom  string name of the rom file
+    @param seed uint32_t seed of the random number generator
+*/
+void init_side(check_side* side, std::string rom, uint32_t seed){
+  side->cpu.init();
+  side->cpu.set_seed(seed);
+  side->dmem.init_sprites();
+  side->dmem.init_from_file(ROM_ADDRESS, rom);
+  side->time = std::chrono::steady_clock::duration::zero();
+}
+
+/** hash_side
+    Compute the hash of the state of a run, as Machine::hash does
+    without the counters of the machine.
+
+    @param side check_side* run to hash
+    @return uint64_t FNV-1a hash of the state
+*/
+uint64_t hash_side(check_side* side){
+  uint64_t h = FNV_OFFSET;
+  h = side->cpu.hash(h);
+  h = side->dmem.hash(h);
+  h = side->vmem.hash(h);
+  return h;
+}
+
+/** usage
+    Print how to use the program.
+
+*/
+void usage(){
+  std::cerr << "usage: chip8_aot_check path_to_rom [options]\n"
+               "  --cycles N  instructions to execute (default 1000000)\n"
+               "  --keys FILE input script or recording with the key events\n"
+               "  --ips N     instructions per second of emulated time (default 700)\n"
+               "  --seed N    seed of the random number generator (default 1)\n";
+}
+
+int main(int argc, char* argv[]){
+
+  if(argc < 2){
+    usage();
+    throw std::invalid_argument("Not enough arguments to run");
+  }
+
+  std::string rom = argv[1];
+  std::string keys;
+  uint64_t cycles = 1000000;
+  uint64_t ips = 0;
+  uint32_t seed = 1;
+  bool seeded = false;
+
+  for(int i = 2; i < argc; i++){
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if     (arg == "--cycles" && has_value) cycles = std::stoull(argv[++i]);
+    else if(arg == "--keys"   && has_value) keys = argv[++i];
+    else if(arg == "--ips"    && has_value) ips = std::stoull(argv[++i]);
+    else if(arg == "--seed"   && has_value) seed = std::stoul(argv[++i]), seeded = true;
+    else {
+      usage();
+      throw std::invalid_argument("Argument not valid: " + arg);
+    }
+  }
+
+  std::ifstream file(rom, std::ios::binary);
+  if(!file){
+    throw std::invalid_argument("Rom not opened correctly");
+  }
+
+  std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  const chip8_aot_program* program = chip8_aot_runner::find(chip8_aot_runner::hash_rom(bytes.data(), bytes.size()));
+  if(!program){
+    throw std::invalid_argument("Rom not translated: " + rom);
+  }
+
+  InputScript script;
+  if(!keys.empty()) script.init_from_file(keys);
+
+  // The options win over the settings of a recording
+  if(!seeded && script.has_seed()) seed = script.get_seed();
+  if(ips == 0) ips = script.get_ips() ? script.get_ips() : DEFAULT_IPS;
+
+  // The reference steps one instruction at a time, the interpreter and
+  // the translated code run the same slices as Machine::run
+  std::vector<check_side> sides(3);
+  check_side* reference   = &sides[0];
+  check_side* interpreter = &sides[1];
+  check_side* translated  = &sides[2];
+
+  for(auto& side : sides) init_side(&side, rom, seed);
+
+  // Loops doing nothing are run as well, so that the speeds compare the same work
+  interpreter->cpu.set_idle_detection(false);
+
+  chip8_aot_runner runner(program);
+
+  uint64_t cycle = 0;
+  uint64_t ticks = 0;
+
+  auto tick_cycle = [ips](uint64_t tick){ return (tick * ips + TIMER_HZ - 1) / TIMER_HZ; };
+
+  while(cycle < cycles){
+
+    uint64_t next_tick = tick_cycle(ticks + 1);
+
+    // The timers tick before the instruction of their cycle,
+    // and the runs are compared at each tick
+    if(cycle == next_tick){
+      for(auto& side : sides) side.cpu.tick_timers();
+      ticks++;
+
+      uint64_t h = hash_side(reference);
+
+      if(hash_side(interpreter) != h || hash_side(translated) != h){
+        std::cout << "mismatch at cycle " << cycle << ", frame " << ticks << std::endl;
+        std::cout << "reference:" << std::endl;
+        reference->cpu.regs_dump();
+        std::cout << "interpreter:" << std::endl;
+        interpreter->cpu.regs_dump();
+        std::cout << "translated:" << std::endl;
+        translated->cpu.regs_dump();
+        return 1;
+      }
+
+      continue;
+    }
+
+    uint16_t key = script.key_at(cycle);
+
+    uint64_t slice = cycles - cycle;
+    if(next_tick - cycle < slice) slice = next_tick - cycle;
+    uint64_t next = script.next_event(cycle);
+    if(next - cycle < slice) slice = next - cycle;
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < slice; i++) reference->cpu.step(&reference->dmem, &reference->vmem, key);
+    auto middle = std::chrono::steady_clock::now();
+    interpreter->cpu.run(&interpreter->dmem, &interpreter->vmem, key, slice);
+    auto end = std::chrono::steady_clock::now();
+    runner.run(&translated->cpu, &translated->dmem, &translated->vmem, key, slice);
+
+    reference->time   += middle - start;
+    interpreter->time += end - middle;
+    translated->time  += std::chrono::steady_clock::now() - end;
+
+    cycle += slice;
+  }
+
+  bool same = hash_side(interpreter) == hash_side(reference) && hash_side(translated) == hash_side(reference);
+
+  auto speed = [cycles](check_side* side){
+    double seconds = std::chrono::duration<double>(side->time).count();
+    return (seconds > 0) ? cycles / seconds : 0;
+  };
+
+  char line[200];
+  snprintf(line, sizeof(line),
+           "%s: %llu cycles, %llu frames compared, %.1f%% of the instructions translated\n"
+           "step %.0f instructions/s, interpreter %.0f instructions/s, translated %.0f instructions/s",
+           program->name, (unsigned long long) cycles, (unsigned long long) ticks,
+           100.0 * runner.get_translated() / (runner.get_translated() + runner.get_interpreted() + (cycles == 0)),
+           speed(reference), speed(interpreter), speed(translated));
+
+  std::cout << line << std::endl;
+  std::cout << (same ? "0 mismatches" : "mismatch at the end") << std::endl;
+
+  return same ? 0 : 1;
+}
@@ -0,0 +1,376 @@
+#include "aot.h"
+#include "machine.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Instructions in a block at most, so that blocks fit in the slices
+// between two ticks of the timers
+#define AOT_MAX_BLOCK 32
+
+// Rom being translated, with what is known of each address
+struct aot_rom {
+  std::string          name;
+  std::vector<uint8_t> bytes;
+
+  // Addresses reached by the control flow, and first addresses of the blocks
+  std::vector<uint8_t> reached;
+  std::vector<uint8_t> leader;
+};
+
+/** in_rom
+    Check whether an instruction at a given address is in the rom.
+
+    @param rom  const aot_rom& rom
+    @param addr uint32_t address of the instruction
+    @return bool whether both bytes are in the rom
+*/
+bool in_rom(const aot_rom& rom, uint32_t addr){
+  return addr >= ROM_ADDRESS && addr + 1 < ROM_ADDRESS + rom.bytes.size();
+}
+
+/** fetch
+    Read the instruction at a given address of the rom, msb first.
+
+    @param rom  const aot_rom& rom
+    @param addr uint32_t address of the instruction, in the rom
+    @return uint16_t instruction
+*/
+uint16_t fetch(const aot_rom& rom, uint32_t addr){
+  return rom.bytes[addr - ROM_ADDRESS] << 8 | rom.bytes[addr - ROM_ADDRESS + 1];
+}
+
+/** skip_target
+    Get the address a skip at a given address goes to when taken:
+    the long load F000 nnnn is skipped as a whole.
+
+    @param rom  const aot_rom& rom
+    @param addr uint32_t address of the skip
+    @return uint32_t address of the instruction after the skipped one
+*/
+uint32_t skip_target(const aot_rom& rom, uint32_t addr){
+  return (in_rom(rom, addr + 2) && fetch(rom, addr + 2) == 0xf000) ? addr + 6 : addr + 4;
+}
+
+/** is_skip
+    Check whether an opcode is a conditional skip.
+
+    @param op uint8_t chip8_opcode
+    @return bool whether the instruction is a skip
+*/
+bool is_skip(uint8_t op){
+  return op == OP_3xkk_SE  || op == OP_4xkk_SNE || op == OP_5xy0_SE ||
+         op == OP_9xy0_SNE || op == OP_Ex9E_SKP || op == OP_ExA1_SKNP;
+}
+
+/** ends_block
+    Check whether an opcode changes the control flow,
+    so that it is the last instruction of its block.
+
+    @param op uint8_t chip8_opcode
+    @return bool whether the instruction ends the block
+*/
+bool ends_block(uint8_t op){
+  return is_skip(op) || op == OP_1nnn_JP || op == OP_2nnn_CALL || op == OP_00EE_RET ||
+         op == OP_Bnnn_JP || op == OP_Fx0A_LD || op == OP_00FD_EXIT;
+}
+
+/** explore
+    Follow the control flow of a rom from ROM_ADDRESS, marking the
+    addresses reached and the ones starting a block. Returns, Bnnn,
+    Fx0A and 00FD have no known target, and the invalid instructions
+    stop the exploration: they are left to the interpreter.
+
+    @param rom aot_rom* rom to explore
+*/
+void explore(aot_rom* rom){
+
+  rom->reached.assign(DATA_MEMORY_SIZE, 0);
+  rom->leader.assign(DATA_MEMORY_SIZE, 0);
+
+  std::vector<uint32_t> work = { ROM_ADDRESS };
+  rom->leader[ROM_ADDRESS] = 1;
+
+  auto branch = [rom, &work](uint32_t target){
+    if(target >= DATA_MEMORY_SIZE) return;
+    rom->leader[target] = 1;
+    work.push_back(target);
+  };
+
+  while(!work.empty()){
+    uint32_t addr = work.back();
+    work.pop_back();
+
+    if(!in_rom(*rom, addr) || rom->reached[addr]) continue;
+
+    uint16_t IR = fetch(*rom, addr);
+    uint8_t op = chip8_aot::opcode(IR);
+    if(op == OP_INVALID) continue;
+
+    rom->reached[addr] = 1;
+
+    switch(op){
+      case OP_1nnn_JP:   branch(IR & 0x0fff); break;
+      case OP_2nnn_CALL: branch(IR & 0x0fff); branch(addr + 2); break;
+      case OP_Fx0A_LD:   branch(addr + 2); break;
+      case OP_F000_LD:   work.push_back(addr + 4); break;
+
+      case OP_00EE_RET:
+      case OP_Bnnn_JP:
+      case OP_00FD_EXIT:
+        break;
+
+      default:
+        if(is_skip(op)){
+          branch(addr + 2);
+          branch(skip_target(*rom, addr));
+        }
+        else work.push_back(addr + 2);
+    }
+  }
+}
+
+/** translate
+    Write the C++ statements executing an instruction, from the
+    legacy behavior of the instr_* methods. The instructions changing
+    the control flow set PC and return; the ones with no inline code
+    are executed by chip8::execute, with PC at their address.
+
+    @param rom    const aot_rom& rom
+    @param addr   uint32_t address of the instruction
+    @param count  uint32_t instructions of the block up to this one included
+    @param code   std::ostringstream* where to write the statements
+*/
+void translate(const aot_rom& rom, uint32_t addr, uint32_t count, std::ostringstream* code){
+
+  uint16_t IR = fetch(rom, addr);
+  uint8_t op = chip8_aot::opcode(IR);
+
+  int x = (IR >> 8) & 0xf, y = (IR >> 4) & 0xf;
+  unsigned kk = IR & 0xff, nnn = IR & 0xfff;
+  char line[200];
+
+  #define EMIT(...) snprintf(line, sizeof(line), __VA_ARGS__), *code << "  " << line << "\n"
+  #define SKIP(cond) EMIT("PC = (%s) ? 0x%04x : 0x%04x; return %u;", cond, skip_target(rom, addr), addr + 2, count)
+
+  std::string vx = "V[" + std::to_string(x) + "]";
+  std::string vy = "V[" + std::to_string(y) + "]";
+  const char* X = vx.c_str();
+  const char* Y = vy.c_str();
+
+  switch(op){
+    case OP_1nnn_JP:   EMIT("PC = 0x%03x; return %u;", nnn, count); break;
+    case OP_2nnn_CALL: EMIT("PC = 0x%04x; chip8_aot::call(c, 0x%03x); return %u;", addr + 2, nnn, count); break;
+    case OP_00EE_RET:  EMIT("chip8_aot::ret(c); return %u;", count); break;
+    case OP_Bnnn_JP:   EMIT("PC = V[0] + 0x%03x; return %u;", nnn, count); break;
+
+    case OP_3xkk_SE:   SKIP((vx + " == " + std::to_string(kk)).c_str()); break;
+    case OP_4xkk_SNE:  SKIP((vx + " != " + std::to_string(kk)).c_str()); break;
+    case OP_5xy0_SE:   SKIP((vx + " == " + vy).c_str()); break;
+    case OP_9xy0_SNE:  SKIP((vx + " != " + vy).c_str()); break;
+    case OP_Ex9E_SKP:  SKIP(("s->key & (1 << " + vx + ")").c_str()); break;
+    case OP_ExA1_SKNP: SKIP(("~s->key & (1 << " + vx + ")").c_str()); break;
+
+    case OP_6xkk_LD:   EMIT("%s = %u;", X, kk); break;
+    case OP_7xkk_ADD:  EMIT("%s += %u;", X, kk); break;
+    case OP_8xy0_LD:   EMIT("%s = %s;", X, Y); break;
+    case OP_8xy1_OR:   EMIT("%s |= %s;", X, Y); break;
+    case OP_8xy2_AND:  EMIT("%s &= %s;", X, Y); break;
+    case OP_8xy3_XOR:  EMIT("%s ^= %s;", X, Y); break;
+    case OP_8xy4_ADD:  EMIT("t = %s + %s; V[15] = t >= 256; %s = t;", X, Y, X); break;
+    case OP_8xy5_SUB:  EMIT("V[15] = %s > %s; %s -= %s;", X, Y, X, Y); break;
+    case OP_8xy6_SHR:  EMIT("V[15] = %s & 1; %s >>= 1;", X, X); break;
+    case OP_8xy7_SUBN: EMIT("V[15] = %s > %s; %s = %s - %s;", Y, X, X, Y, X); break;
+    case OP_8xyE_SHL:  EMIT("V[15] = (%s & 0x80) != 0; %s <<= 1;", X, X); break;
+    case OP_Annn_LD:   EMIT("I = 0x%03x;", nnn); break;
+    case OP_Cxkk_RND:  EMIT("%s = chip8_aot::random(c) & %u;", X, kk); break;
+    case OP_Fx07_LD:   EMIT("%s = chip8_aot::DT(c);", X); break;
+    case OP_Fx15_LD:   EMIT("chip8_aot::DT(c) = %s;", X); break;
+    case OP_Fx18_LD:   EMIT("chip8_aot::ST(c) = %s;", X); break;
+    case OP_Fx1E_ADD:  EMIT("I = %s + I;", X); break;
+    case OP_Fx29_LD:   EMIT("I = %s * 5;", X); break;
+    case OP_Fx30_LD:   EMIT("I = %u + (%s & 0x0f) * 10;", BIG_FONT_ADDRESS, X); break;
+    case OP_F000_LD:   EMIT("I = 0x%04x;", in_rom(rom, addr + 2) ? fetch(rom, addr + 2) : 0); break;
+    case OP_00FD_EXIT: EMIT("PC = 0x%04x; return %u;", addr, count); break;
+
+    // Wait on itself until a key is pressed, then store the first one
+    case OP_Fx0A_LD:
+      EMIT("if(s->key == 0){ PC = 0x%04x; return %u; }", addr, count);
+      EMIT("for(t = 0; !(s->key & (1 << t)); t++);");
+      EMIT("%s = t; PC = 0x%04x; return %u;", X, addr + 2, count);
+      break;
+
+    default:
+      EMIT("PC = 0x%04x; chip8_aot::execute(c, 0x%04x, s->mem, s->vmem, s->key);", addr, IR);
+
+      // An instruction writing over translated code ends the block
+      if(op == OP_Fx33_LD || op == OP_Fx55_LD || op == OP_5xy2_LD)
+        EMIT("if(s->code_written) return %u;", count);
+  }
+
+  #undef EMIT
+  #undef SKIP
+}
+
+/** emit_program
+    Cut the code reached in a rom into blocks, and write
+    their functions and the table of the program.
+
+    @param rom   const aot_rom& explored rom
+    @param index int index of the rom, naming its namespace
+    @param out   std::ostream& where to write the code
+    @return uint32_t number of blocks
+*/
+uint32_t emit_program(aot_rom& rom, int index, std::ostream& out){
+
+  std::ostringstream table;
+  uint32_t blocks = 0;
+
+  out << "namespace rom_" << index << " {\n\n";
+
+  for(uint32_t start = ROM_ADDRESS; start < DATA_MEMORY_SIZE; start++){
+
+    if(!rom.leader[start] || !rom.reached[start]) continue;
+
+    std::ostringstream code;
+    uint32_t addr = start;
+    uint32_t count = 0;
+    bool ended = false;
+
+    while(!ended){
+      uint8_t op = chip8_aot::opcode(fetch(rom, addr));
+
+      count++;
+      translate(rom, addr, count, &code);
+
+      ended = ends_block(op);
+      addr += (op == OP_F000_LD) ? 4 : 2;
+
+      // Fall into the next block, or leave the rest to the interpreter
+      if(!ended && (rom.leader[addr] || !rom.reached[addr] || count == AOT_MAX_BLOCK)){
+        if(rom.reached[addr]) rom.leader[addr] = 1;
+        code << "  PC = 0x" << std::hex << addr << std::dec << "; return " << count << ";\n";
+        ended = true;
+      }
+
+      // A skip also depends on the instruction it skips
+      else if(is_skip(op)) addr += 2;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "block_%04x", start);
+
+    out << "uint32_t " << name << "(chip8_aot_state* s){\n"
+        << "  chip8* c = s->cpu;\n"
+        << "  uint8_t* V = &chip8_aot::V(c, 0);\n"
+        << "  uint16_t& I = chip8_aot::I(c);\n"
+        << "  uint16_t& PC = chip8_aot::PC(c);\n"
+        << "  uint16_t t;\n"
+        << "  (void) V; (void) I; (void) PC; (void) t;\n"
+        << code.str()
+        << "}\n\n";
+
+    table << "  { 0x" << std::hex << start << ", " << std::dec << (addr - start) << ", "
+          << count << ", " << name << " },\n";
+    blocks++;
+  }
+
+  out << "const uint8_t rom[] = {";
+  for(size_t i = 0; i < rom.bytes.size(); i++)
+    out << ((i % 16 == 0) ? "\n  " : " ") << (int) rom.bytes[i] << ",";
+  out << "\n};\n\n";
+
+  out << "const chip8_aot_block blocks[] = {\n" << table.str() << "};\n\n";
+
+  out << "const chip8_aot_program program = {\n"
+      << "  \"" << rom.name << "\", 0x" << std::hex
+      << chip8_aot_runner::hash_rom(rom.bytes.data(), rom.bytes.size()) << std::dec << "ULL,\n"
+      << "  rom, sizeof(rom), blocks, sizeof(blocks) / sizeof(blocks[0])\n"
+      << "};\n\n"
+      << "}\n\n";
+
+  return blocks;
+}
+
+/** usage
+    Print how to use the program.
+
+*/
+void usage(){
+  std::cerr << "usage: chip8_aotc path_to_rom... [options]\n"
+               "  -o FILE  C++ file to write (default: standard output)\n";
+}
+
+int main(int argc, char* argv[]){
+
+  std::vector<std::string> roms;
+  std::string output;
+
+  for(int i = 1; i < argc; i++){
+    std::string arg = argv[i];
+
+    if(arg == "-o" && i + 1 < argc) output = argv[++i];
+    else if(arg[0] == '-'){
+      usage();
+      throw std::invalid_argument("Argument not valid: " + arg);
+    }
+    else roms.push_back(arg);
+  }
+
+  if(roms.empty()){
+    usage();
+    throw std::invalid_argument("Not enough arguments to run");
+  }
+
+  std::ostringstream out;
+
+  out << "// Generated by chip8_aotc, do not edit\n"
+      << "#include \"aot.h\"\n\n";
+
+  for(size_t i = 0; i < roms.size(); i++){
+
+    aot_rom rom;
+    rom.name = roms[i].substr(roms[i].find_last_of('/') + 1);
+
+    std::ifstream file(roms[i], std::ios::binary);
+    if(!file){
+      throw std::invalid_argument("Rom not opened correctly: " + roms[i]);
+    }
+
+    rom.bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    if(ROM_ADDRESS + rom.bytes.size() > DATA_MEMORY_SIZE){
+      throw std::invalid_argument("Rom too big for the memory: " + roms[i]);
+    }
+
+    explore(&rom);
+    uint32_t blocks = emit_program(rom, i, out);
+
+    uint32_t reached = 0;
+    for(uint8_t r : rom.reached) reached += r;
+
+    std::cerr << rom.name << ": " << reached << " instructions in " << blocks << " blocks" << std::endl;
+  }
+
+  out << "const chip8_aot_program* const chip8_aot_programs[] = {\n";
+  for(size_t i = 0; i < roms.size(); i++) out << "  &rom_" << i << "::program,\n";
+  out << "  nullptr\n};\n";
+
+  if(output.empty()){
+    std::cout << out.str();
+    return 0;
+  }
+
+  std::ofstream file(output);
+  if(!file){
+    throw std::invalid_argument("Output file not opened correctly");
+  }
+
+  file << out.str();
+  return 0;
+}
@@ -0,0 +1,150 @@
+#include "audio.h"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+/** Audio_chip8::Audio_chip8
+    Constructor of the class.
+    Opens the default audio device, 16 bits mono, and starts
+    the callback. With no device the emulator runs silent.
+
+    @param samples uint16_t samples in a buffer of the device,
+                   which bounds the latency of the sound
+*/
+Audio_chip8::Audio_chip8(uint16_t samples) : latest(0) {
+
+  this->device = 0;
+  this->rate = AUDIO_RATE;
+  this->played = 0;
+  this->state = AudioEvent();
+  this->phase = 0;
+  this->step = 0;
+
+  if(SDL_InitSubSystem(SDL_INIT_AUDIO) != 0){
+    std::cerr << "Audio not available: " << SDL_GetError() << std::endl;
+    return;
+  }
+
+  SDL_AudioSpec wanted, obtained;
+  SDL_zero(wanted);
+  wanted.freq     = AUDIO_RATE;
+  wanted.format   = AUDIO_S16SYS;
+  wanted.channels = 1;
+  wanted.samples  = samples;
+  wanted.callback = Audio_chip8::callback;
+  wanted.userdata = this;
+
+  // The device may pick its own rate and buffer size, the samples stay 16 bits mono
+  this->device = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained,
+                                     SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+
+  if(!this->device){
+    std::cerr << "Audio not available: " << SDL_GetError() << std::endl;
+    return;
+  }
+
+  this->rate = obtained.freq;
+  SDL_PauseAudioDevice(this->device, 0);
+}
+
+/** Audio_chip8::push
+    Hand the state of the sound at the end of a frame to the callback.
+    Called by the emulation thread once per frame of emulated time;
+    it never waits, and if the callback stopped taking the frames
+    the queue is full and the frame is dropped: latest then stays at
+    the last frame queued, so the callback never waits for it.
+
+    @param frame uint64_t frame of emulated time, increasing at each call
+    @param cpu   chip8* CPU whose sound is played
+*/
+void Audio_chip8::push(uint64_t frame, chip8* cpu){
+
+  if(!this->device) return;
+
+  AudioEvent event;
+  event.frame = frame;
+  event.on    = cpu->sound_on();
+  event.pitch = cpu->get_pitch();
+  memcpy(event.pattern, cpu->get_pattern(), AUDIO_PATTERN_SIZE);
+
+  if(this->queue.push(event)) this->latest.store(frame, std::memory_order_release);
+}
+
+/** Audio_chip8::is_open
+    Tell whether the sound is played.
+
+    @return bool whether the audio device was opened
+*/
+bool Audio_chip8::is_open(){
+  return this->device != 0;
+}
+
+/** Audio_chip8::callback
+    Called by SDL on its audio thread each time the device needs samples.
+
+    @param userdata void* Audio_chip8 playing the sound
+    @param stream   Uint8* buffer to fill
+    @param len      int size of the buffer in bytes
+*/
+void Audio_chip8::callback(void* userdata, Uint8* stream, int len){
+  static_cast<Audio_chip8*>(userdata)->fill((int16_t*) stream, len / sizeof(int16_t));
+}
+
+/** Audio_chip8::fill
+    Fill a buffer with the frames pushed since the previous one.
+    The first new frame starts at the beginning of the buffer and
+    the others follow at equal distances, so that with one frame it
+    is heard right away, and with several, in turbo or after a delay
+    of the device, each one is heard in order for a shorter time.
+    With no new frame, the last one keeps playing.
+
+    The pattern is played msb first, at 4000 * 2^((pitch - 64) / 48)
+    bits per second, as a square wave of amplitude AUDIO_VOLUME.
+
+    @param out     int16_t* samples to write
+    @param samples int number of samples
+*/
+void Audio_chip8::fill(int16_t* out, int samples){
+
+  uint64_t latest = this->latest.load(std::memory_order_acquire);
+  uint64_t span = (latest > this->played) ? latest - this->played : 0;
+
+  AudioEvent event;
+
+  for(int i = 0; i < samples; i++){
+
+    // Frame heard at this sample, never one pushed after latest was read
+    uint64_t frame = this->played + 1 + span * i / samples;
+    if(frame > latest) frame = latest;
+
+    while(this->queue.peek(&event) && event.frame <= frame){
+      this->queue.pop();
+      this->state = event;
+      this->step = 4000 * std::pow(2.0, (event.pitch - AUDIO_DEFAULT_PITCH) / 48.0) / this->rate;
+    }
+
+    if(!this->state.on){
+      out[i] = 0;
+      continue;
+    }
+
+    int bit = (int) this->phase;
+    bool high = (this->state.pattern[bit / 8] >> (7 - bit % 8)) & 1;
+    out[i] = high ? AUDIO_VOLUME : -AUDIO_VOLUME;
+
+    this->phase += this->step;
+    if(this->phase >= 8 * AUDIO_PATTERN_SIZE) this->phase -= 8 * AUDIO_PATTERN_SIZE;
+  }
+
+  if(latest > this->played) this->played = latest;
+}
+
+/** Audio_chip8::~Audio_chip8
+    Destroyer of the class.
+    Closing the device waits for the callback to return.
+
+*/
+Audio_chip8::~Audio_chip8(){
+  if(this->device) SDL_CloseAudioDevice(this->device);
+  SDL_QuitSubSystem(SDL_INIT_AUDIO);
+}
@@ -0,0 +1,70 @@
+#ifndef __AUDIO_H
+#define __AUDIO_H
+
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <atomic>
+#include "chip8.h"
+#include "pipeline.h"
+
+// Samples per second asked to the audio device
+#define AUDIO_RATE 48000
+
+// Default samples in a buffer of the device, 5.3 ms at AUDIO_RATE
+#define AUDIO_BUFFER 256
+
+// Amplitude of the buzzer, out of 32767
+#define AUDIO_VOLUME 4000
+
+// Frames of sound in flight from the emulation thread to the callback
+#define AUDIO_QUEUE_SIZE 256
+
+// State of the sound at the end of a frame of emulated time
+struct AudioEvent {
+
+  // Frame of emulated time, counted by the emulation thread
+  uint64_t frame;
+
+  // Whether the buzzer sounds, and the XO-CHIP pattern it plays
+  bool     on;
+  uint8_t  pitch;
+  uint8_t  pattern[AUDIO_PATTERN_SIZE];
+};
+
+// Buzzer of the emulator, played by the SDL audio callback.
+// The emulation thread pushes the state of the sound at the end of
+// each frame of emulated time to a queue with no lock, and the
+// callback plays the frames pushed since its previous buffer,
+// spread over the new buffer by their frame number. So the CPU never
+// waits for the audio, the sound follows the emulation by one buffer
+// of the device at most, and in turbo the frames are played faster
+// instead of piling up.
+class Audio_chip8 {
+  SDL_AudioDeviceID device;
+
+  // Samples per second of the device
+  int rate;
+
+  SpscQueue<AudioEvent, AUDIO_QUEUE_SIZE> queue;
+
+  // Last frame queued by the emulation thread
+  std::atomic<uint64_t> latest;
+
+  // Owned by the callback: frame played at the end of the last buffer,
+  // sound being played, and position in its pattern
+  uint64_t   played;
+  AudioEvent state;
+  double     phase;
+  double     step;
+
+  static void callback(void*, Uint8*, int);
+  void        fill(int16_t*, int);
+
+public:
+        Audio_chip8(uint16_t);
+  void  push(uint64_t, chip8*);
+  bool  is_open();
+        ~Audio_chip8();
+};
+
+#endif // !__AUDIO_H
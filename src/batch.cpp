@@ -0,0 +1,170 @@
+#include "machine.h"
+#include "input_script.h"
+#include "thread_pool.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Job of the manifest, with its result
+struct batch_job {
+  std::string rom;
+  std::string keys;
+  uint32_t    seed;
+  uint64_t    cycles;
+
+  uint64_t    executed;
+  uint64_t    hash;
+  double      seconds;
+  std::string error;
+};
+
+/** read_manifest
+    Read the jobs to run from a manifest.
+    The file has one job per line, made of the rom, the input script
+    (- for none), the seed of the random number generator and the
+    number of instructions to execute. Empty lines and lines
+    starting with # are ignored.
+
+    @param file_name string name of the manifest
+    @return vector<batch_job> jobs to run
+*/
+std::vector<batch_job> read_manifest(std::string file_name){
+
+  std::ifstream file(file_name);
+  if(!file){
+    throw std::invalid_argument("Manifest not opened correctly");
+  }
+
+  std::vector<batch_job> jobs;
+  std::string line;
+
+  while(std::getline(file, line)){
+
+    size_t first = line.find_first_not_of(" \t\r");
+    if(first == std::string::npos || line[first] == '#') continue;
+
+    std::istringstream fields(line);
+    batch_job job;
+
+    if(!(fields >> job.rom >> job.keys >> job.seed >> job.cycles)){
+      throw std::invalid_argument("Manifest line not valid: " + line);
+    }
+
+    if(job.keys == "-") job.keys.clear();
+    job.executed = 0;
+    job.hash = 0;
+    job.seconds = 0;
+    jobs.push_back(job);
+  }
+
+  return jobs;
+}
+
+/** run_job
+    Run a job on its own machine and store the result in it.
+
+    @param job batch_job* job to run
+*/
+void run_job(batch_job* job){
+
+  try {
+    Machine machine;
+    InputScript script;
+
+    machine.load(job->rom);
+    machine.set_seed(job->seed);
+
+    if(!job->keys.empty()){
+      script.init_from_file(job->keys);
+      machine.set_input(&script);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    job->executed = machine.run(job->cycles);
+    auto stop = std::chrono::steady_clock::now();
+
+    job->seconds = std::chrono::duration<double>(stop - start).count();
+    job->hash = machine.hash();
+  }
+  catch(std::exception& e){
+    job->error = e.what();
+  }
+}
+
+/** usage
+    Print how to use the program.
+
+*/
+void usage(){
+  std::cerr << "usage: chip8_batch manifest [--threads N]\n"
+               "  each line of the manifest is: rom keys_script|- seed cycles\n";
+}
+
+int main(int argc, char* argv[]){
+
+  if(argc < 2){
+    usage();
+    throw std::invalid_argument("Not enough arguments to run");
+  }
+
+  size_t threads = 0;
+
+  for(int i = 2; i < argc; i++){
+    std::string arg = argv[i];
+
+    if(arg == "--threads" && i + 1 < argc) threads = std::stoul(argv[++i]);
+    else {
+      usage();
+      throw std::invalid_argument("Argument not valid: " + arg);
+    }
+  }
+
+  std::vector<batch_job> jobs = read_manifest(argv[1]);
+
+  auto start = std::chrono::steady_clock::now();
+  size_t workers;
+
+  {
+    ThreadPool pool(threads);
+    workers = pool.size();
+
+    for(auto& job : jobs) pool.submit([&job]{ run_job(&job); });
+    pool.wait();
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  uint64_t total = 0;
+  int failed = 0;
+
+  // One line per job, in the order of the manifest
+  std::cout << "job rom seed cycles hash ips" << std::endl;
+
+  for(size_t i = 0; i < jobs.size(); i++){
+    batch_job& job = jobs[i];
+    char hash[20];
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long) job.hash);
+
+    std::cout << i << " " << job.rom << " " << job.seed << " ";
+
+    if(!job.error.empty()){
+      std::cout << "error: " << job.error << std::endl;
+      failed++;
+      continue;
+    }
+
+    std::cout << job.executed << " " << hash << " "
+              << (uint64_t) (job.executed / ((job.seconds > 0) ? job.seconds : 1e-9)) << std::endl;
+    total += job.executed;
+  }
+
+  std::cerr << jobs.size() << " jobs, " << failed << " failed, "
+            << workers << " threads, " << seconds << " s, "
+            << (uint64_t) (total / ((seconds > 0) ? seconds : 1e-9)) << " instructions/s" << std::endl;
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,347 @@
+#include "machine.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+// Program of a micro-benchmark: the prelude runs once, then the body
+// is repeated to fill a loop, closed by a jump back to its start
+struct micro_bench {
+  const char*           name;
+  std::vector<uint16_t> prelude;
+  std::vector<uint16_t> body;
+};
+
+// Address of the data used by the memory instructions
+#define BENCH_DATA 0x800
+
+// Copies of the body in the loop
+#define BENCH_UNROLL 64
+
+// Result of a benchmark: rate of each repetition, in units per second
+struct bench_result {
+  std::string         name;
+  std::string         unit;
+  std::vector<double> rates;
+};
+
+/** percentile
+    Get a percentile of a sorted list of values, by nearest rank.
+
+    @param sorted const std::vector<double>& values, in increasing order
+    @param p      double percentile, from 0 to 100
+    @return double value at the percentile
+*/
+double percentile(const std::vector<double>& sorted, double p){
+  size_t rank = (size_t) (p / 100 * (sorted.size() - 1) + 0.5);
+  return sorted[rank];
+}
+
+/** measure
+    Run a function several times, after some runs to warm up
+    the caches and the branch predictors.
+
+    @param result  bench_result* where to add the rate of each repetition
+    @param warmup  int number of runs not measured
+    @param reps    int number of runs measured
+    @param units   double units of work done by each run
+    @param run     function to measure
+*/
+template<typename F>
+void measure(bench_result* result, int warmup, int reps, double units, F run){
+
+  for(int i = 0; i < warmup; i++) run();
+
+  for(int i = 0; i < reps; i++){
+    auto start = std::chrono::steady_clock::now();
+    run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result->rates.push_back(units / ((seconds > 0) ? seconds : 1e-9));
+  }
+}
+
+/** micro_benchmarks
+    Programs measuring each class of instructions on its own.
+
+    @return std::vector<micro_bench> the programs
+*/
+std::vector<micro_bench> micro_benchmarks(){
+
+  // V1 = 5, V2 = 3, VA = 9, I = BENCH_DATA
+  const std::vector<uint16_t> regs = { 0x6105, 0x6203, 0x6a09, 0xA000 | BENCH_DATA };
+
+  // The calls go to a subroutine which returns right away, so
+  // 2nnn_00EE measures a call and a return for each instruction of the body
+  return {
+    { "00E0_CLS",  regs, { 0x00e0 } },
+    { "1nnn_JP",   regs, { 0x1000 } },
+    { "2nnn_00EE", regs, { 0x2000 } },
+    { "3xkk_SE",   regs, { 0x3100 } },
+    { "4xkk_SNE",  regs, { 0x4105 } },
+    { "5xy0_SE",   regs, { 0x5120 } },
+    { "6xkk_LD",   regs, { 0x6312 } },
+    { "7xkk_ADD",  regs, { 0x7301 } },
+    { "8xy0_LD",   regs, { 0x8310 } },
+    { "8xy1_OR",   regs, { 0x8311 } },
+    { "8xy2_AND",  regs, { 0x8312 } },
+    { "8xy3_XOR",  regs, { 0x8313 } },
+    { "8xy4_ADD",  regs, { 0x8314 } },
+    { "8xy5_SUB",  regs, { 0x8315 } },
+    { "8xy6_SHR",  regs, { 0x8316 } },
+    { "8xy7_SUBN", regs, { 0x8317 } },
+    { "8xyE_SHL",  regs, { 0x831e } },
+    { "9xy0_SNE",  regs, { 0x9110 } },
+    { "Annn_LD",   regs, { 0xA000 | BENCH_DATA } },
+    { "Bnnn_JP",   regs, { 0xB000 } },
+    { "Cxkk_RND",  regs, { 0xC3ff } },
+    { "Ex9E_SKP",  regs, { 0xE19E } },
+    { "ExA1_SKNP", regs, { 0xE1A1 } },
+    { "Fx07_LD",   regs, { 0xF307 } },
+    { "Fx15_LD",   regs, { 0xF115 } },
+    { "Fx18_LD",   regs, { 0xF118 } },
+    { "Fx1E_ADD",  regs, { 0xF11E } },
+    { "Fx29_LD",   regs, { 0xFA29 } },
+    { "Fx33_LD",   regs, { 0xFA33 } },
+    { "Fx55_LD",   regs, { 0xFF55 } },
+    { "Fx65_LD",   regs, { 0xFF65 } },
+
+    // Sequences run as a single instruction by the decode cache
+    { "6xkk_6xkk",      regs, { 0x6312, 0x6413 } },
+    { "7xkk_3xkk_1nnn", regs, { 0x7301, 0x3300, 0x1000 } },
+    { "Fx07_3xkk_1nnn", regs, { 0xF307, 0x3301, 0x1000 } },
+  };
+}
+
+/** load_micro
+    Write the program of a micro-benchmark in a memory.
+    Jumps get the address of the next instruction filled in,
+    calls the address of a subroutine placed after the loop.
+
+    @param bench const micro_bench& program to write
+    @param mem   DataMemory* memory to write
+*/
+void load_micro(const micro_bench& bench, DataMemory* mem){
+
+  uint16_t addr = ROM_ADDRESS;
+
+  for(uint16_t instr : bench.prelude) mem->write_instruction(addr, instr), addr += 2;
+
+  uint16_t loop = addr;
+  uint16_t end = loop + 2 * BENCH_UNROLL * bench.body.size();
+  uint16_t subroutine = end + 2;
+
+  for(int i = 0; i < BENCH_UNROLL; i++){
+    for(uint16_t instr : bench.body){
+      uint16_t next = addr + 2;
+
+      // Bnnn adds V0, which is 0
+      if(instr == 0x1000 || instr == 0xB000) instr |= next;
+      if(instr == 0x2000) instr |= subroutine;
+
+      mem->write_instruction(addr, instr), addr += 2;
+    }
+  }
+
+  mem->write_instruction(end, 0x1000 | loop);
+  mem->write_instruction(subroutine, 0x00ee);
+}
+
+/** sprite_benchmarks
+    Programs drawing sprites, at positions aligned and not aligned
+    to the bytes of the video memory, and wrapping around the screen;
+    then the same in high resolution, and scrolling the screen.
+
+    @return std::vector<micro_bench> the programs
+*/
+std::vector<micro_bench> sprite_benchmarks(){
+
+  // I = sprite of 0, V0 = x, V1 = y; 00FF switches to high resolution,
+  // F301 selects both planes
+  return {
+    { "Dxyn_aligned",   { 0xA000, 0x6008, 0x6104 }, { 0xD015 } },
+    { "Dxyn_unaligned", { 0xA000, 0x6003, 0x6104 }, { 0xD015 } },
+    { "Dxyn_wrapping",  { 0xA000, 0x603e, 0x611e }, { 0xD015 } },
+    { "Dxyn_moving",    { 0xA000, 0x6000, 0x6100 }, { 0xD015, 0x7003, 0x7101 } },
+    { "Annn_Dxyn",      { 0x6008, 0x6104 }, { 0xA000, 0xD015 } },
+    { "Dxyn_hires",     { 0x00ff, 0xA000, 0x603b, 0x6104 }, { 0xD015 } },
+    { "Dxy0_hires",     { 0x00ff, 0xA000, 0x603b, 0x6104 }, { 0xD010 } },
+    { "Dxyn_planes",    { 0x00ff, 0xF301, 0xA000, 0x603b, 0x6104 }, { 0xD015 } },
+    { "00Cn_SCD",       { 0x00ff }, { 0x00c1 } },
+    { "00FB_SCR",       { 0x00ff }, { 0x00fb } },
+  };
+}
+
+/** usage
+    Print how to use the program.
+
+*/
+void usage(){
+  std::cerr << "usage: chip8_bench [options] [roms...]\n"
+               "  --cycles N   instructions in each repetition (default 1000000)\n"
+               "  --reps N     measured repetitions (default 15)\n"
+               "  --warmup N   repetitions before measuring (default 3)\n"
+               "  --cpu N      pin the benchmark to a CPU (default 0, -1 to not pin)\n"
+               "  --filter S   run only the benchmarks whose name contains S\n"
+               "  --format F   text, json or csv (default text)\n"
+               "  with no roms, every .ch8 file in rom/ is run\n";
+}
+
+int main(int argc, char* argv[]){
+
+  uint64_t cycles = 1000000;
+  int reps = 15;
+  int warmup = 3;
+  int cpu = 0;
+  std::string filter;
+  std::string format = "text";
+  std::vector<std::string> roms;
+
+  for(int i = 1; i < argc; i++){
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if     (arg == "--cycles" && has_value) cycles = std::stoull(argv[++i]);
+    else if(arg == "--reps"   && has_value) reps = std::stoi(argv[++i]);
+    else if(arg == "--warmup" && has_value) warmup = std::stoi(argv[++i]);
+    else if(arg == "--cpu"    && has_value) cpu = std::stoi(argv[++i]);
+    else if(arg == "--filter" && has_value) filter = argv[++i];
+    else if(arg == "--format" && has_value) format = argv[++i];
+    else if(arg.compare(0, 2, "--") != 0)   roms.push_back(arg);
+    else {
+      usage();
+      throw std::invalid_argument("Argument not valid: " + arg);
+    }
+  }
+
+  if(cycles == 0 || reps <= 0 || warmup < 0){
+    throw std::invalid_argument("Cycles and repetitions have to be positive");
+  }
+
+  if(format != "text" && format != "json" && format != "csv"){
+    throw std::invalid_argument("Format not valid: " + format);
+  }
+
+#if defined(__linux__)
+
+  // Keep the benchmark on one CPU, so that the caches stay warm
+  if(cpu >= 0){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(sched_setaffinity(0, sizeof(set), &set) != 0)
+      std::cerr << "could not pin to CPU " << cpu << std::endl;
+  }
+
+#endif
+
+  if(roms.empty() && std::filesystem::is_directory("rom")){
+    for(auto& entry : std::filesystem::directory_iterator("rom"))
+      if(entry.path().extension() == ".ch8") roms.push_back(entry.path().string());
+
+    std::sort(roms.begin(), roms.end());
+  }
+
+  std::vector<bench_result> results;
+
+  // ========= micro-benchmarks, one class of instructions at a time
+
+  std::vector<micro_bench> micro = micro_benchmarks();
+  std::vector<micro_bench> sprites = sprite_benchmarks();
+  micro.insert(micro.end(), sprites.begin(), sprites.end());
+
+  for(const micro_bench& bench : micro){
+
+    if(std::string(bench.name).find(filter) == std::string::npos) continue;
+
+    chip8 cpu;
+    DataMemory dmem;
+    VideoMemory vmem;
+
+    cpu.init();
+    cpu.set_seed(1);
+
+    // The loops of most micro-benchmarks repeat the same state
+    cpu.set_idle_detection(false);
+    dmem.init_sprites();
+    load_micro(bench, &dmem);
+
+    bench_result result = { bench.name, "instructions/s", {} };
+    measure(&result, warmup, reps, cycles, [&](){
+      cpu.run(&dmem, &vmem, 0, cycles);
+    });
+
+    results.push_back(result);
+  }
+
+  // ========= full roms, with no keys pressed
+
+  for(const std::string& rom : roms){
+
+    if(rom.find(filter) == std::string::npos) continue;
+
+    Machine machine;
+    machine.load(rom);
+    machine.set_seed(1);
+
+    // Roms spend most of their time waiting, which would be skipped
+    machine.get_cpu()->set_idle_detection(false);
+
+    bench_result result = { rom, "instructions/s", {} };
+    measure(&result, warmup, reps, cycles, [&](){
+      machine.run(cycles);
+    });
+
+    results.push_back(result);
+
+    // Frames of emulated time at the default speed
+    bench_result frames = { rom, "frames/s", {} };
+    for(double rate : result.rates) frames.rates.push_back(rate * TIMER_HZ / DEFAULT_IPS);
+
+    results.push_back(frames);
+  }
+
+  // ========= report
+
+  if(format == "json") std::cout << "[\n";
+  if(format == "csv")  std::cout << "name,unit,reps,min,p10,median,p90,max\n";
+
+  for(size_t i = 0; i < results.size(); i++){
+
+    std::vector<double> sorted = results[i].rates;
+    std::sort(sorted.begin(), sorted.end());
+
+    double values[5] = { sorted.front(), percentile(sorted, 10), percentile(sorted, 50),
+                         percentile(sorted, 90), sorted.back() };
+    char line[512];
+
+    if(format == "text"){
+      snprintf(line, sizeof(line), "%-24s %14.0f %-15s p10 %14.0f  p90 %14.0f",
+               results[i].name.c_str(), values[2], results[i].unit.c_str(), values[1], values[3]);
+    }
+    else if(format == "csv"){
+      snprintf(line, sizeof(line), "%s,%s,%zu,%.0f,%.0f,%.0f,%.0f,%.0f",
+               results[i].name.c_str(), results[i].unit.c_str(), sorted.size(),
+               values[0], values[1], values[2], values[3], values[4]);
+    }
+    else {
+      snprintf(line, sizeof(line),
+               "  {\"name\": \"%s\", \"unit\": \"%s\", \"reps\": %zu, \"min\": %.0f, "
+               "\"p10\": %.0f, \"median\": %.0f, \"p90\": %.0f, \"max\": %.0f}%s",
+               results[i].name.c_str(), results[i].unit.c_str(), sorted.size(),
+               values[0], values[1], values[2], values[3], values[4],
+               (i + 1 < results.size()) ? "," : "");
+    }
+
+    std::cout << line << std::endl;
+  }
+
+  if(format == "json") std::cout << "]" << std::endl;
+}
@@ -1,5 +1,230 @@
 #include "chip8.h"
+#include "snapshot.h"
+#include "profile.h"
+#include <cstring>
 #include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+// Execute stage, shared by chip8::run_impl and chip8::execute.
+// Expects d to point to the decoded instruction, Q to be the quirks
+// profile, and the macros HANDLER, NEXT and FALLBACK to be defined
+// by the dispatch in use, IDLE_JUMP and IDLE_WAIT by the callers
+// which skip idle loops.
+#define CHIP8_HANDLERS \
+    HANDLER(00E0_CLS)  instr_00E0_CLS(vmem);                          NEXT(); \
+    HANDLER(00EE_RET)  instr_00EE_RET();                              NEXT(); \
+    HANDLER(1nnn_JP)   IDLE_JUMP(d->nnn); instr_1nnn_JP(d->nnn);      NEXT(); \
+    HANDLER(2nnn_CALL) instr_2nnn_CALL(d->nnn);                       NEXT(); \
+    HANDLER(3xkk_SE)   instr_3xkk_SE(d->x, d->kk, mem);               NEXT(); \
+    HANDLER(4xkk_SNE)  instr_4xkk_SNE(d->x, d->kk, mem);              NEXT(); \
+    HANDLER(5xy0_SE)   instr_5xy0_SE(d->x, d->y, mem);                NEXT(); \
+    HANDLER(6xkk_LD)   instr_6xkk_LD(d->x, d->kk);                    NEXT(); \
+    HANDLER(7xkk_ADD)  instr_7xkk_ADD(d->x, d->kk);                   NEXT(); \
+    HANDLER(8xy0_LD)   instr_8xy0_LD(d->x, d->y);                     NEXT(); \
+    HANDLER(8xy1_OR)   instr_8xy1_OR<Q>(d->x, d->y);                  NEXT(); \
+    HANDLER(8xy2_AND)  instr_8xy2_AND<Q>(d->x, d->y);                 NEXT(); \
+    HANDLER(8xy3_XOR)  instr_8xy3_XOR<Q>(d->x, d->y);                 NEXT(); \
+    HANDLER(8xy4_ADD)  instr_8xy4_ADD(d->x, d->y);                    NEXT(); \
+    HANDLER(8xy5_SUB)  instr_8xy5_SUB(d->x, d->y);                    NEXT(); \
+    HANDLER(8xy6_SHR)  instr_8xy6_SHR<Q>(d->x, d->y);                 NEXT(); \
+    HANDLER(8xy7_SUBN) instr_8xy7_SUBN(d->x, d->y);                   NEXT(); \
+    HANDLER(8xyE_SHL)  instr_8xyE_SHL<Q>(d->x, d->y);                 NEXT(); \
+    HANDLER(9xy0_SNE)  instr_9xy0_SNE(d->x, d->y, mem);               NEXT(); \
+    HANDLER(Annn_LD)   instr_Annn_LD(d->nnn);                         NEXT(); \
+    HANDLER(Bnnn_JP)   instr_Bnnn_JP<Q>(d->nnn);                      NEXT(); \
+    HANDLER(Cxkk_RND)  instr_Cxkk_RND(d->x, d->kk);                   NEXT(); \
+    HANDLER(Dxyn_DRW)  instr_Dxyn_DRW<Q>(d->x, d->y, d->n, mem, vmem); NEXT(); \
+    HANDLER(Ex9E_SKP)  instr_Ex9E_SKP(d->x, key, mem);                NEXT(); \
+    HANDLER(ExA1_SKNP) instr_ExA1_SKNP(d->x, key, mem);               NEXT(); \
+    HANDLER(Fx07_LD)   instr_Fx07_LD(d->x);                           NEXT(); \
+    HANDLER(Fx0A_LD)   instr_Fx0A_LD(d->x, key); IDLE_WAIT(key);      NEXT(); \
+    HANDLER(Fx15_LD)   instr_Fx15_LD(d->x);                           NEXT(); \
+    HANDLER(Fx18_LD)   instr_Fx18_LD(d->x);                           NEXT(); \
+    HANDLER(Fx1E_ADD)  instr_Fx1E_ADD(d->x);                          NEXT(); \
+    HANDLER(Fx29_LD)   instr_Fx29_LD(d->x);                           NEXT(); \
+    HANDLER(Fx33_LD)   instr_Fx33_LD(d->x, mem);                      NEXT(); \
+    HANDLER(Fx55_LD)   instr_Fx55_LD<Q>(d->x, mem);                   NEXT(); \
+    HANDLER(Fx65_LD)   instr_Fx65_LD<Q>(d->x, mem);                   NEXT(); \
+    HANDLER(00Cn_SCD)  instr_00Cn_SCD(d->n, vmem);                    NEXT(); \
+    HANDLER(00Dn_SCU)  instr_00Dn_SCU(d->n, vmem);                    NEXT(); \
+    HANDLER(00FB_SCR)  instr_00FB_SCR(vmem);                          NEXT(); \
+    HANDLER(00FC_SCL)  instr_00FC_SCL(vmem);                          NEXT(); \
+    HANDLER(00FD_EXIT) instr_00FD_EXIT(); IDLE_WAIT(0);               NEXT(); \
+    HANDLER(00FE_LOW)  instr_00FE_LOW(vmem);                          NEXT(); \
+    HANDLER(00FF_HIGH) instr_00FF_HIGH(vmem);                         NEXT(); \
+    HANDLER(5xy2_LD)   instr_5xy2_LD(d->x, d->y, mem);                NEXT(); \
+    HANDLER(5xy3_LD)   instr_5xy3_LD(d->x, d->y, mem);                NEXT(); \
+    HANDLER(F000_LD)   instr_F000_LD(mem);                            NEXT(); \
+    HANDLER(Fn01_PLANE) instr_Fn01_PLANE(d->x);                       NEXT(); \
+    HANDLER(Fx30_LD)   instr_Fx30_LD(d->x);                           NEXT(); \
+    HANDLER(Fx75_LD)   instr_Fx75_LD(d->x);                           NEXT(); \
+    HANDLER(Fx85_LD)   instr_Fx85_LD(d->x);                           NEXT(); \
+    HANDLER(F002_LD)   instr_F002_LD(mem);                            NEXT(); \
+    HANDLER(Fx3A_PITCH) instr_Fx3A_PITCH(d->x);                       NEXT(); \
+                                                                              \
+    /* In case no instruction was recognized, an error is thrown */           \
+    HANDLER(INVALID)                                                          \
+    FALLBACK()                                                                \
+      throw std::invalid_argument("Instruction received not valid");
+
+// Sequences fused by the decode cache, run by chip8::run_impl only.
+// d points to the first instruction, d + 2 and d + 4 to the next ones,
+// which FUSED_STEP fetches. The last instruction is counted by NEXT, and
+// when the run has fewer instructions left than the sequence, only the
+// first one is executed. The skips of the loops always skip a jump.
+#define CHIP8_FUSED_HANDLERS \
+    HANDLER(Annn_Dxyn) \
+      instr_Annn_LD(d->nnn);                                               \
+      if(cycles < 2) { NEXT(); }                                           \
+      FUSED_STEP(2); instr_Dxyn_DRW<Q>(d[2].x, d[2].y, d[2].n, mem, vmem); NEXT(); \
+    HANDLER(6xkk_6xkk) \
+      instr_6xkk_LD(d->x, d->kk);                                          \
+      if(cycles < 2) { NEXT(); }                                           \
+      FUSED_STEP(2); instr_6xkk_LD(d[2].x, d[2].kk);                       NEXT(); \
+    HANDLER(7xkk_3xkk_1nnn) \
+      instr_7xkk_ADD(d->x, d->kk);                                         \
+      if(cycles < 3) { NEXT(); }                                           \
+      FUSED_STEP(2); if(this->regs[d[2].x] == d[2].kk) { this->PC += 2; NEXT(); } \
+      FUSED_STEP(4); IDLE_JUMP(d[4].nnn); instr_1nnn_JP(d[4].nnn);         NEXT(); \
+    HANDLER(7xkk_4xkk_1nnn) \
+      instr_7xkk_ADD(d->x, d->kk);                                         \
+      if(cycles < 3) { NEXT(); }                                           \
+      FUSED_STEP(2); if(this->regs[d[2].x] != d[2].kk) { this->PC += 2; NEXT(); } \
+      FUSED_STEP(4); IDLE_JUMP(d[4].nnn); instr_1nnn_JP(d[4].nnn);         NEXT(); \
+    HANDLER(Fx07_3xkk_1nnn) \
+      instr_Fx07_LD(d->x);                                                 \
+      if(cycles < 3) { NEXT(); }                                           \
+      FUSED_STEP(2); if(this->regs[d[2].x] == d[2].kk) { this->PC += 2; NEXT(); } \
+      FUSED_STEP(4); IDLE_JUMP(d[4].nnn); instr_1nnn_JP(d[4].nnn);         NEXT(); \
+    HANDLER(Fx07_4xkk_1nnn) \
+      instr_Fx07_LD(d->x);                                                 \
+      if(cycles < 3) { NEXT(); }                                           \
+      FUSED_STEP(2); if(this->regs[d[2].x] != d[2].kk) { this->PC += 2; NEXT(); } \
+      FUSED_STEP(4); IDLE_JUMP(d[4].nnn); instr_1nnn_JP(d[4].nnn);         NEXT();
+
+/** mirror
+    Reverse the order of the bits of a byte.
+
+    @param byte uint8_t byte to mirror
+    @return uint8_t byte with bit n moved to bit 7 - n
+*/
+static inline uint8_t mirror(uint8_t byte){
+  byte = (byte & 0xf0) >> 4 | (byte & 0x0f) << 4;
+  byte = (byte & 0xcc) >> 2 | (byte & 0x33) << 2;
+  byte = (byte & 0xaa) >> 1 | (byte & 0x55) << 1;
+  return byte;
+}
+
+/** Chip8::split
+    Store the opcode and the fields of an instruction.
+
+    @param IR           uint16_t instruction to split
+    @param decode_table const uint8_t* table from instructions to opcodes
+    @param d            chip8_decoded* where to store the result
+*/
+void chip8::split(uint16_t IR, const uint8_t* decode_table, chip8_decoded* d){
+  d->op  = decode_table[IR];
+  d->x   = (IR & 0x0f00) >> 8;
+  d->y   = (IR & 0x00f0) >> 4;
+  d->n   = (IR & 0x000f);
+  d->kk  = (IR & 0x00ff);
+  d->nnn = (IR & 0x0fff);
+  d->fused = d->op;
+}
+
+/** Chip8::decode
+    Decode a 16 bits instruction into the identifier of
+    the operation it performs.
+
+    @param IR uint16_t instruction to decode
+    @return uint8_t chip8_opcode of the instruction, OP_INVALID if not recognized
+*/
+uint8_t chip8::decode(uint16_t IR){
+
+  // bits from 0 to 3
+  uint8_t IR_0    = (IR & 0x000f) >> 0;
+
+  // bits from 12 to 15
+  uint8_t IR_3    = (IR & 0xf000) >> 12;
+
+  // bits from 0 to 7
+  uint8_t IR_01   = (IR & 0x00ff);
+
+  if      (IR   == 0x00e0)                 return OP_00E0_CLS;
+  else if (IR   == 0x00ee)                 return OP_00EE_RET;
+  else if ((IR & 0xfff0) == 0x00c0)        return OP_00Cn_SCD;
+  else if ((IR & 0xfff0) == 0x00d0)        return OP_00Dn_SCU;
+  else if (IR   == 0x00fb)                 return OP_00FB_SCR;
+  else if (IR   == 0x00fc)                 return OP_00FC_SCL;
+  else if (IR   == 0x00fd)                 return OP_00FD_EXIT;
+  else if (IR   == 0x00fe)                 return OP_00FE_LOW;
+  else if (IR   == 0x00ff)                 return OP_00FF_HIGH;
+  else if (IR   == 0xf000)                 return OP_F000_LD;
+  else if (IR   == 0xf002)                 return OP_F002_LD;
+  else if (IR_3 == 0x01)                   return OP_1nnn_JP;
+  else if (IR_3 == 0x02)                   return OP_2nnn_CALL;
+  else if (IR_3 == 0x03)                   return OP_3xkk_SE;
+  else if (IR_3 == 0x04)                   return OP_4xkk_SNE;
+  else if (IR_3 == 0x05 and IR_0 == 0x00)  return OP_5xy0_SE;
+  else if (IR_3 == 0x05 and IR_0 == 0x02)  return OP_5xy2_LD;
+  else if (IR_3 == 0x05 and IR_0 == 0x03)  return OP_5xy3_LD;
+  else if (IR_3 == 0x06)                   return OP_6xkk_LD;
+  else if (IR_3 == 0x07)                   return OP_7xkk_ADD;
+  else if (IR_3 == 0x08 and IR_0 == 0x00)  return OP_8xy0_LD;
+  else if (IR_3 == 0x08 and IR_0 == 0x01)  return OP_8xy1_OR;
+  else if (IR_3 == 0x08 and IR_0 == 0x02)  return OP_8xy2_AND;
+  else if (IR_3 == 0x08 and IR_0 == 0x03)  return OP_8xy3_XOR;
+  else if (IR_3 == 0x08 and IR_0 == 0x04)  return OP_8xy4_ADD;
+  else if (IR_3 == 0x08 and IR_0 == 0x05)  return OP_8xy5_SUB;
+  else if (IR_3 == 0x08 and IR_0 == 0x06)  return OP_8xy6_SHR;
+  else if (IR_3 == 0x08 and IR_0 == 0x07)  return OP_8xy7_SUBN;
+  else if (IR_3 == 0x08 and IR_0 == 0x0e)  return OP_8xyE_SHL;
+  else if (IR_3 == 0x09 and IR_0 == 0x00)  return OP_9xy0_SNE;
+  else if (IR_3 == 0x0a)                   return OP_Annn_LD;
+  else if (IR_3 == 0x0b)                   return OP_Bnnn_JP;
+  else if (IR_3 == 0x0c)                   return OP_Cxkk_RND;
+  else if (IR_3 == 0x0d)                   return OP_Dxyn_DRW;
+  else if (IR_3 == 0x0e and IR_01 == 0x9e) return OP_Ex9E_SKP;
+  else if (IR_3 == 0x0e and IR_01 == 0xa1) return OP_ExA1_SKNP;
+  else if (IR_3 == 0x0f and IR_01 == 0x07) return OP_Fx07_LD;
+  else if (IR_3 == 0x0f and IR_01 == 0x0a) return OP_Fx0A_LD;
+  else if (IR_3 == 0x0f and IR_01 == 0x15) return OP_Fx15_LD;
+  else if (IR_3 == 0x0f and IR_01 == 0x18) return OP_Fx18_LD;
+  else if (IR_3 == 0x0f and IR_01 == 0x1e) return OP_Fx1E_ADD;
+  else if (IR_3 == 0x0f and IR_01 == 0x29) return OP_Fx29_LD;
+  else if (IR_3 == 0x0f and IR_01 == 0x33) return OP_Fx33_LD;
+  else if (IR_3 == 0x0f and IR_01 == 0x55) return OP_Fx55_LD;
+  else if (IR_3 == 0x0f and IR_01 == 0x65) return OP_Fx65_LD;
+  else if (IR_3 == 0x0f and IR_01 == 0x01) return OP_Fn01_PLANE;
+  else if (IR_3 == 0x0f and IR_01 == 0x30) return OP_Fx30_LD;
+  else if (IR_3 == 0x0f and IR_01 == 0x75) return OP_Fx75_LD;
+  else if (IR_3 == 0x0f and IR_01 == 0x85) return OP_Fx85_LD;
+  else if (IR_3 == 0x0f and IR_01 == 0x3a) return OP_Fx3A_PITCH;
+
+  return OP_INVALID;
+}
+
+/** Chip8::build_decode_table
+    Build the table mapping each of the 65536 possible
+    instructions to its chip8_opcode. The table is shared
+    by all the instances and built only once.
+
+    @return const uint8_t* pointer to the 64K entries table
+*/
+const uint8_t* chip8::build_decode_table(){
+
+  static const struct decode_table_t {
+    uint8_t entry[0x10000];
+
+    decode_table_t(){
+      for(uint32_t IR = 0; IR < 0x10000; IR++) entry[IR] = chip8::decode(IR);
+    }
+  } table;
+
+  return table.entry;
+}
 
 /** Chip8::step
     Step for the CPU operation, corresponding to
@@ -7,88 +232,540 @@
     and execute stages, according to the expected behavior.
 
 */
-void chip8::step(Memory* mem, Memory* vmem, uint16_t key){
+void chip8::step(DataMemory* mem, VideoMemory* vmem, uint16_t key){
+  this->run(mem, vmem, key, 1);
+}
+
+/** Chip8::run_impl
+    Execute a given number of instructions with the same key state.
+
+    The fetch and decode stages are served by the decode cache,
+    which holds the opcode and the fields of the instruction
+    at each address of the data memory, so that they are
+    computed only the first time an address is executed.
+    The execute stage jumps straight to the handler of the
+    instruction. By default this is a switch over the
+    chip8_opcode, which the compiler lowers to a jump table;
+    building with CHIP8_COMPUTED_GOTO defined uses the GCC
+    labels-as-values extension instead, so that each handler
+    has its own indirect jump to the next one.
+
+    The timers are not updated here: they count at 60 Hz,
+    whatever the speed of the CPU, and the caller
+    calls tick_timers once every 1/60 s of emulated time.
+
+    Idle loops are skipped, since the keys and the timers cannot
+    change during a run: when Fx0A waits with no key pressed, or when
+    a backward jump is reached again with the same state and nothing
+    was written in between, the CPU would repeat the same instructions
+    until the end of the run. Only the iterations which fit in the
+    instructions left are skipped, so that the state at the end is
+    exactly the one of running them; get_idle tells the caller what
+    can wake the CPU.
+
+    When built with CHIP8_JIT defined, straight-line runs of
+    instructions are translated to native code by chip8_jit
+    and executed as a whole, as long as they fit in the number
+    of instructions still to execute. The interpreter executes
+    everything else, and works as reference for the translated code.
+
+    Common sequences, like a load of I followed by a draw or the
+    loops counting a register or polling the delay timer, are found
+    by the decode cache when it decodes their first instruction, and
+    dispatched once for the whole sequence. They are executed only
+    if they fit in the instructions left, otherwise their first
+    instruction is executed alone.
+
+    The interpreter is instantiated once per quirks profile, and
+    set_quirks selects the instantiation called by chip8::run.
+
+    @param mem    Memory* data memory
+    @param vmem   Memory* video memory
+    @param key    uint16_t mask with the pressed keys
+    @param cycles uint32_t number of instructions to execute
+*/
+template<typename Q>
+void chip8::run_impl(DataMemory* mem, VideoMemory* vmem, uint16_t key, uint32_t cycles){
+
+  const chip8_decoded* d;
+
+#ifdef CHIP8_COMPUTED_GOTO
+
+  // Labels in the same order as chip8_opcode
+  static void* const handlers[OP_FUSED_COUNT] = {
+    &&L_INVALID,
+    &&L_00E0_CLS,  &&L_00EE_RET,   &&L_1nnn_JP,   &&L_2nnn_CALL,
+    &&L_3xkk_SE,   &&L_4xkk_SNE,   &&L_5xy0_SE,   &&L_6xkk_LD,
+    &&L_7xkk_ADD,  &&L_8xy0_LD,    &&L_8xy1_OR,   &&L_8xy2_AND,
+    &&L_8xy3_XOR,  &&L_8xy4_ADD,   &&L_8xy5_SUB,  &&L_8xy6_SHR,
+    &&L_8xy7_SUBN, &&L_8xyE_SHL,   &&L_9xy0_SNE,  &&L_Annn_LD,
+    &&L_Bnnn_JP,   &&L_Cxkk_RND,   &&L_Dxyn_DRW,  &&L_Ex9E_SKP,
+    &&L_ExA1_SKNP, &&L_Fx07_LD,    &&L_Fx0A_LD,   &&L_Fx15_LD,
+    &&L_Fx18_LD,   &&L_Fx1E_ADD,   &&L_Fx29_LD,   &&L_Fx33_LD,
+    &&L_Fx55_LD,   &&L_Fx65_LD,
+    &&L_00Cn_SCD,  &&L_00Dn_SCU,   &&L_00FB_SCR,  &&L_00FC_SCL,
+    &&L_00FD_EXIT, &&L_00FE_LOW,   &&L_00FF_HIGH, &&L_5xy2_LD,
+    &&L_5xy3_LD,   &&L_F000_LD,    &&L_Fn01_PLANE, &&L_Fx30_LD,
+    &&L_Fx75_LD,   &&L_Fx85_LD,    &&L_F002_LD,   &&L_Fx3A_PITCH,
+    &&L_Annn_Dxyn, &&L_6xkk_6xkk,
+    &&L_7xkk_3xkk_1nnn, &&L_7xkk_4xkk_1nnn,
+    &&L_Fx07_3xkk_1nnn, &&L_Fx07_4xkk_1nnn,
+  };
+
+  #define HANDLER(op)  L_##op:
+  #define DISPATCH()   goto *handlers[d->fused];
+  #define NEXT()       if(--cycles == 0) return; goto fetch
+  #define FALLBACK()
+
+#else
+
+  #define HANDLER(op)  case OP_##op:
+  #define DISPATCH()   switch(d->fused)
+  #define NEXT()       break
+  #define FALLBACK()   default:
+
+#endif
+
+  // Move to the instruction at d + k of a fused sequence, counting the previous one
+  #define FUSED_STEP(k)  CHIP8_PROFILE_INSTRUCTION(d + (k), this->PC); this->PC += 2; cycles--;
+
+  #define IDLE_JUMP(nnn) if((nnn) < this->PC && this->idle_detection) cycles -= this->skip_idle(cycles);
+  #define IDLE_WAIT(key) if((key) == 0 && this->idle_detection) this->idle = IDLE_KEY, cycles = 1;
+
+  this->idle = IDLE_NONE;
+  this->idle_pc = IDLE_NO_JUMP;
+
+  if(cycles == 0) return;
+
+  // The cache has to be built on the memory in use
+  if(!this->icache.is_attached(mem)){
+    this->icache.attach(mem);
+#ifdef CHIP8_JIT
+    this->icache.chain(&this->jit);
+#endif
+  }
+
+  // Entries of the cache, kept in locals so that they stay in registers.
+  // They only move when an entry is filled. The limit never covers the
+  // last byte of the memory, where no instruction can start, so that a
+  // single check at each fetch finds both
+  const chip8_decoded* entries;
+  uint32_t limit;
+
+  #define LOAD_ENTRIES() \
+    entries = this->icache.data(); \
+    limit = std::min(this->icache.size(), (uint32_t) DECODE_CACHE_SIZE - 1);
+
+  LOAD_ENTRIES();
+
+fetch:
+
+  // Both the bytes of the instruction have to be in memory,
+  // and the cache grows up to the instruction
+  if(this->PC >= limit){
+    if(this->PC >= DECODE_CACHE_SIZE - 1)
+      throw std::invalid_argument( "Address cannot be the last byte of the memory" );
+
+    this->icache.fill(this->PC, this->decode_table);
+    LOAD_ENTRIES();
+  }
+
+#ifdef CHIP8_JIT
+
+  // ========= translated block
+
+  // The translated code follows the legacy profile for the instructions it covers
+  if(!Q::shift_vy && !Q::logic_resets_vf && this->jit_enabled){
+    uint8_t length;
+    chip8_block_fn block = this->jit.lookup(this->PC, &this->icache, this->decode_table, &length);
+    LOAD_ENTRIES();
+
+    if(block && length <= cycles){
+#ifdef CHIP8_PROFILE
+      for(int i = 0; i < length; i++) CHIP8_PROFILE_INSTRUCTION(this->icache.at(this->PC + 2 * i), this->PC + 2 * i);
+#endif
+      block(this->regs, &this->I);
+      this->PC += 2 * length;
+
+      cycles -= length;
+      if(cycles == 0) return;
+      goto fetch;
+    }
+  }
 
-  // ========= fetch stage
+#endif
 
-  // Fetch 16 bits instruction from memory, msb first
-  uint8_t msb_instr = mem->read(this->PC);
-  uint8_t lsb_instr = mem->read(this->PC+1);
-  uint16_t IR = (msb_instr << 8 | lsb_instr);
+  // ========= fetch and decode stages
+
+  // Decode the instruction only if not done yet
+  d = &entries[this->PC];
+  if(d->op == OP_UNCACHED){
+    this->icache.fill(this->PC, this->decode_table);
+    LOAD_ENTRIES();
+    d = &entries[this->PC];
+  }
+
+  CHIP8_PROFILE_INSTRUCTION(d, this->PC);
 
   // Increment program counter
   this->PC += 2;
 
-  // Update timers
-  if(DT > 0) DT--;
-  if(ST > 0) ST--;
+  // ========= execute stage
 
-  // ========= decode stage
+  DISPATCH() {
+    CHIP8_FUSED_HANDLERS
+    CHIP8_HANDLERS
+  }
 
-  // bits from 0 to 3
-  uint8_t IR_0    = (IR & 0x000f) >> 0;
+#ifndef CHIP8_COMPUTED_GOTO
+  if(--cycles != 0) goto fetch;
+#endif
+
+  #undef HANDLER
+  #undef DISPATCH
+  #undef NEXT
+  #undef FALLBACK
+  #undef FUSED_STEP
+  #undef LOAD_ENTRIES
+  #undef IDLE_JUMP
+  #undef IDLE_WAIT
+}
 
-  // bits from 4 to 7
-  uint8_t IR_1    = (IR & 0x00f0) >> 4;
+/** Chip8::run
+    Execute a given number of instructions, with
+    the interpreter of the quirks profile in use.
 
-  // bits from 8 to 11
-  uint8_t IR_2    = (IR & 0x0f00) >> 8;
+    @param mem    Memory* data memory
+    @param vmem   Memory* video memory
+    @param key    uint16_t mask with the pressed keys
+    @param cycles uint32_t number of instructions to execute
+*/
+void chip8::run(DataMemory* mem, VideoMemory* vmem, uint16_t key, uint32_t cycles){
+  (this->*run_fn)(mem, vmem, key, cycles);
+}
 
-  // bits from 12 to 15
-  uint8_t IR_3    = (IR & 0xf000) >> 12;
+/** Chip8::skip_idle
+    Called by chip8::run before each backward jump. The state of the
+    CPU is kept at the last jump; when the same jump is reached again
+    with the same registers, stack and timers, and no memory was written
+    in between, the instructions in between are a loop which does the
+    same thing at each iteration, until the keys or the timers change.
 
-  // bits from 0 to 7
-  uint8_t IR_01   = (IR & 0x00ff);
+    @param cycles uint32_t instructions left in the run, including the jump
+    @return uint32_t number of instructions to skip, a multiple of the loop length
+*/
+uint32_t chip8::skip_idle(uint32_t cycles){
 
-  // bits from 0 to 11
-  uint16_t IR_012 = (IR & 0x0fff);
+  uint16_t at = this->PC - 2;
 
-  // ========= execute stage
+  if(at == this->idle_pc && this->writes == this->idle_writes &&
+     this->I == this->idle_I && this->SP == this->idle_SP &&
+     this->DT == this->idle_DT && this->ST == this->idle_ST && this->rng == this->idle_rng &&
+     this->planes == this->idle_planes &&
+     memcmp(this->regs, this->idle_regs, sizeof(this->regs)) == 0 &&
+     memcmp(this->stack + 1, this->idle_stack + 1, this->SP * sizeof(uint16_t)) == 0){
+
+    uint32_t length = this->idle_cycles - cycles;
+    uint32_t skipped = (cycles - 1) / length * length;
+
+    // A jump to itself can only be left by a change of the keys, if ever
+    this->idle = (length == 1) ? IDLE_KEY : IDLE_TIMER;
+    this->idle_cycles = cycles - skipped;
+    return skipped;
+  }
+
+  this->idle_pc = at;
+  this->idle_cycles = cycles;
+  this->idle_writes = this->writes;
+  this->idle_I = this->I;
+  this->idle_SP = this->SP;
+  this->idle_DT = this->DT;
+  this->idle_ST = this->ST;
+  this->idle_rng = this->rng;
+  this->idle_planes = this->planes;
+  memcpy(this->idle_regs, this->regs, sizeof(this->regs));
+  memcpy(this->idle_stack + 1, this->stack + 1, this->SP * sizeof(uint16_t));
+
+  return 0;
+}
+
+/** Chip8::execute
+    Execute a single instruction, given by the caller instead of
+    being fetched from memory. PC is updated as if the
+    instruction was fetched at PC, as chip8::run does, with
+    the quirks profile in use.
+
+    @param IR   uint16_t instruction to execute
+    @param mem  Memory* data memory
+    @param vmem Memory* video memory
+    @param key  uint16_t mask with the pressed keys
+*/
+void chip8::execute(uint16_t IR, DataMemory* mem, VideoMemory* vmem, uint16_t key){
+  (this->*execute_fn)(IR, mem, vmem, key);
+}
+
+/** Chip8::execute_impl
+    Execute a single instruction given by the caller, with the
+    behavior of a quirks profile. Instantiated once per profile.
+
+    @param IR   uint16_t instruction to execute
+    @param mem  Memory* data memory
+    @param vmem Memory* video memory
+    @param key  uint16_t mask with the pressed keys
+*/
+template<typename Q>
+void chip8::execute_impl(uint16_t IR, DataMemory* mem, VideoMemory* vmem, uint16_t key){
+
+  chip8_decoded decoded;
+  const chip8_decoded* d = &decoded;
+
+  split(IR, this->decode_table, &decoded);
+
+  CHIP8_PROFILE_INSTRUCTION(d, this->PC);
+
+  // Increment program counter
+  this->PC += 2;
+
+  #define HANDLER(op)    case OP_##op:
+  #define NEXT()         break
+  #define FALLBACK()     default:
+  #define IDLE_JUMP(nnn)
+  #define IDLE_WAIT(key)
+
+  switch(d->op){
+    CHIP8_HANDLERS
+  }
+
+  #undef HANDLER
+  #undef NEXT
+  #undef FALLBACK
+  #undef IDLE_JUMP
+  #undef IDLE_WAIT
+}
+
+/** Chip8_decode_cache::chip8_decode_cache
+    Constructor of the class.
+    The cache starts empty and not attached to any memory.
+
+*/
+chip8_decode_cache::chip8_decode_cache(){
+  this->mem = nullptr;
+  this->next = nullptr;
+}
+
+/** Chip8_decode_cache::chip8_decode_cache
+    Copy constructor. The copy is not attached to any memory,
+    so it starts empty and gets filled again once used.
+
+*/
+chip8_decode_cache::chip8_decode_cache(const chip8_decode_cache&) : chip8_decode_cache() {}
+
+/** Chip8_decode_cache::operator=
+    Assignment. The cache keeps its own memory,
+    and the entries are not copied.
+
+*/
+chip8_decode_cache& chip8_decode_cache::operator=(const chip8_decode_cache&){
+  return *this;
+}
+
+/** Chip8_decode_cache::~chip8_decode_cache
+    Destroyer of the class.
+    Stop observing the memory, if still attached to one.
+
+*/
+chip8_decode_cache::~chip8_decode_cache(){
+  if(this->mem) this->mem->set_observer(nullptr);
+}
+
+// Entry of the addresses past the ones allocated
+const chip8_decoded chip8_decode_cache::uncached = { OP_UNCACHED, 0, 0, 0, 0, OP_UNCACHED, 0 };
+
+/** Chip8_decode_cache::writable
+    Get the entry of an address to fill it, allocating
+    the entries up to it, by DECODE_CACHE_STEP addresses.
+
+    @param addr uint16_t address of the instruction
+    @return chip8_decoded* entry of the address
+*/
+chip8_decoded* chip8_decode_cache::writable(uint16_t addr){
+
+  if(addr >= this->entries.size())
+    this->entries.resize((addr / DECODE_CACHE_STEP + 1) * DECODE_CACHE_STEP, uncached);
+
+  return &this->entries[addr];
+}
+
+/** Chip8_decode_cache::is_attached
+    Check whether the cache holds the instructions of a memory.
+
+    @param mem Memory* memory to check
+    @return bool whether the cache is attached to mem
+*/
+bool chip8_decode_cache::is_attached(DataMemory* mem){
+  return this->mem == mem;
+}
+
+/** Chip8_decode_cache::attach
+    Start caching the instructions of a new memory.
+    All the entries are dropped.
+
+    @param mem Memory* data memory to observe
+*/
+void chip8_decode_cache::attach(DataMemory* mem){
+  if(this->mem) this->mem->set_observer(nullptr);
 
-  if      (IR   == 0x00e0)                 instr_00E0_CLS(vmem);
-  else if (IR   == 0x00ee)                 instr_00EE_RET();
-  else if (IR_3 == 0x01)                   instr_1nnn_JP(IR_012);
-  else if (IR_3 == 0x02)                   instr_2nnn_CALL(IR_012);
-  else if (IR_3 == 0x03)                   instr_3xkk_SE(IR_2, IR_01);
-  else if (IR_3 == 0x04)                   instr_4xkk_SNE(IR_2, IR_01);
-  else if (IR_3 == 0x05 and IR_0 == 0x00)  instr_5xy0_SE(IR_2, IR_1);
-  else if (IR_3 == 0x06)                   instr_6xkk_LD(IR_2, IR_01);
-  else if (IR_3 == 0x07)                   instr_7xkk_ADD(IR_2, IR_01);
-  else if (IR_3 == 0x08 and IR_0 == 0x00)  instr_8xy0_LD(IR_2, IR_1);
-  else if (IR_3 == 0x08 and IR_0 == 0x01)  instr_8xy1_OR(IR_2, IR_1);
-  else if (IR_3 == 0x08 and IR_0 == 0x02)  instr_8xy2_AND(IR_2, IR_1);
-  else if (IR_3 == 0x08 and IR_0 == 0x03)  instr_8xy3_XOR(IR_2, IR_1);
-  else if (IR_3 == 0x08 and IR_0 == 0x04)  instr_8xy4_ADD(IR_2, IR_1);
-  else if (IR_3 == 0x08 and IR_0 == 0x05)  instr_8xy5_SUB(IR_2, IR_1);
-  else if (IR_3 == 0x08 and IR_0 == 0x06)  instr_8xy6_SHR(IR_2, IR_1);
-  else if (IR_3 == 0x08 and IR_0 == 0x07)  instr_8xy7_SUBN(IR_2, IR_1);
-  else if (IR_3 == 0x08 and IR_0 == 0x0e)  instr_8xyE_SHL(IR_2, IR_1);
-  else if (IR_3 == 0x09 and IR_0 == 0x00)  instr_9xy0_SNE(IR_2, IR_1);
-  else if (IR_3 == 0x0a)                   instr_Annn_LD(IR_012);
-  else if (IR_3 == 0x0b)                   instr_Bnnn_JP(IR_012);
-  else if (IR_3 == 0x0c)                   instr_Cxkk_RND(IR_2, IR_01);
-  else if (IR_3 == 0x0d)                   instr_Dxyn_DRW(IR_2, IR_1, IR_0, mem, vmem);
-  else if (IR_3 == 0x0e and IR_01 == 0x9e) instr_Ex9E_SKP(IR_2, key);
-  else if (IR_3 == 0x0e and IR_01 == 0xa1) instr_ExA1_SKNP(IR_2, key);
-  else if (IR_3 == 0x0f and IR_01 == 0x07) instr_Fx07_LD(IR_2);
-  else if (IR_3 == 0x0f and IR_01 == 0x0a) instr_Fx0A_LD(IR_2, key);
-  else if (IR_3 == 0x0f and IR_01 == 0x15) instr_Fx15_LD(IR_2);
-  else if (IR_3 == 0x0f and IR_01 == 0x18) instr_Fx18_LD(IR_2);
-  else if (IR_3 == 0x0f and IR_01 == 0x1e) instr_Fx1E_ADD(IR_2);
-  else if (IR_3 == 0x0f and IR_01 == 0x29) instr_Fx29_LD(IR_2);
-  else if (IR_3 == 0x0f and IR_01 == 0x33) instr_Fx33_LD(IR_2, mem);
-  else if (IR_3 == 0x0f and IR_01 == 0x55) instr_Fx55_LD(IR_2, mem);
-  else if (IR_3 == 0x0f and IR_01 == 0x65) instr_Fx65_LD(IR_2, mem);
-  // In case no instruction was recognized, an error is thrown
-  else throw std::invalid_argument("Instruction received not valid");
+  this->invalidate(0, DECODE_CACHE_SIZE);
+  this->mem = mem;
+  this->mem->set_observer(this);
+}
+
+/** Chip8_decode_cache::chain
+    Set an object to notify each time entries are dropped,
+    so that it can drop whatever it built from them.
+    The object starts from an empty state.
+
+    @param next MemoryObserver* object to notify
+*/
+void chip8_decode_cache::chain(MemoryObserver* next){
+  this->next = next;
+  if(this->next) this->next->on_write(0, DECODE_CACHE_SIZE);
+}
+
+/** Chip8_decode_cache::fill
+    Fetch the instruction at a given address, msb first,
+    and store its opcode and fields in the cache.
+
+    @param addr         uint16_t address of the instruction
+    @param decode_table const uint8_t* table from instructions to opcodes
+*/
+void chip8_decode_cache::fill(uint16_t addr, const uint8_t* decode_table){
+
+  uint16_t IR = (this->mem->read(addr) << 8 | this->mem->read(addr + 1));
+  chip8::split(IR, decode_table, this->writable(addr));
+
+  this->fuse(addr, decode_table);
+}
+
+/** Chip8_decode_cache::fuse
+    Check whether the instruction at a given address starts a sequence
+    which chip8::run executes as a whole, and if so store the opcode
+    of the sequence in its entry. The other instructions of the
+    sequence are decoded as well, since the handler reads their fields
+    from the entries following the first one.
+
+    @param addr         uint16_t address of the first instruction, already decoded
+    @param decode_table const uint8_t* table from instructions to opcodes
+*/
+void chip8_decode_cache::fuse(uint16_t addr, const uint8_t* decode_table){
+
+  if(addr + DECODE_FUSED_SIZE > DECODE_CACHE_SIZE) return;
+
+  uint16_t IR[3];
+  uint8_t op[3];
+
+  for(int i = 0; i < 3; i++){
+    IR[i] = (this->mem->read(addr + 2 * i) << 8 | this->mem->read(addr + 2 * i + 1));
+    op[i] = decode_table[IR[i]];
+  }
+
+  uint8_t fused = op[0];
+  int length = 1;
+
+  if(op[0] == OP_Annn_LD && op[1] == OP_Dxyn_DRW)
+    fused = OP_Annn_Dxyn, length = 2;
+  else if(op[0] == OP_6xkk_LD && op[1] == OP_6xkk_LD)
+    fused = OP_6xkk_6xkk, length = 2;
+  else if(op[0] == OP_7xkk_ADD && op[1] == OP_3xkk_SE && op[2] == OP_1nnn_JP)
+    fused = OP_7xkk_3xkk_1nnn, length = 3;
+  else if(op[0] == OP_7xkk_ADD && op[1] == OP_4xkk_SNE && op[2] == OP_1nnn_JP)
+    fused = OP_7xkk_4xkk_1nnn, length = 3;
+  else if(op[0] == OP_Fx07_LD && op[1] == OP_3xkk_SE && op[2] == OP_1nnn_JP)
+    fused = OP_Fx07_3xkk_1nnn, length = 3;
+  else if(op[0] == OP_Fx07_LD && op[1] == OP_4xkk_SNE && op[2] == OP_1nnn_JP)
+    fused = OP_Fx07_4xkk_1nnn, length = 3;
+
+  for(int i = 1; i < length; i++)
+    if(this->at(addr + 2 * i)->op == OP_UNCACHED) chip8::split(IR[i], decode_table, this->writable(addr + 2 * i));
+
+  this->writable(addr)->fused = fused;
+}
+
+/** Chip8_decode_cache::invalidate
+    Drop the entries using the bytes of a range of addresses.
+    Since an entry may hold a fused sequence, the entries starting
+    up to DECODE_FUSED_SIZE - 1 bytes before the range are dropped as well.
+
+    @param addr uint16_t first address of the range
+    @param size uint32_t number of bytes in the range
+*/
+void chip8_decode_cache::invalidate(uint16_t addr, uint32_t size){
+
+  uint32_t first = (addr >= DECODE_FUSED_SIZE - 1) ? addr - (DECODE_FUSED_SIZE - 1) : 0;
+  uint32_t last  = addr + size;
+
+  if(last > DECODE_CACHE_SIZE) last = DECODE_CACHE_SIZE;
+
+  // The addresses past the entries allocated have nothing to drop
+  if(last > this->entries.size()) last = this->entries.size();
+
+  for(uint32_t i = first; i < last; i++) this->entries[i].op = OP_UNCACHED;
+
+  if(this->next) this->next->on_write(addr, size);
+}
+
+/** Chip8_decode_cache::on_write
+    Called by the memory after each write.
+
+    @param addr uint16_t first address written
+    @param size uint32_t number of bytes written
+*/
+void chip8_decode_cache::on_write(uint16_t addr, uint32_t size){
+  this->invalidate(addr, size);
+}
+
+/** Chip8_decode_cache::on_detach
+    Called by the memory when it stops being observed.
+
+    @param mem const void* memory detaching the cache
+*/
+void chip8_decode_cache::on_detach(const void* mem){
+  if(this->mem == mem) this->mem = nullptr;
+}
+
+/** Chip8::skip_next
+    Skip the next instruction. The long load F000 nnnn
+    is 4 bytes long, and is skipped as a whole.
+
+    @param mem Memory* data memory
+*/
+void chip8::skip_next(DataMemory* mem){
+  if(mem->read(this->PC) == 0xf0 && mem->read(this->PC + 1) == 0x00) this->PC += 4;
+  else                                                                this->PC += 2;
+}
+
+/** Chip8::clear_screen
+    Clear some planes of the video memory.
+
+    @param vmem   Memory* video memory
+    @param planes uint8_t mask of the planes to clear
+*/
+void chip8::clear_screen(VideoMemory* vmem, uint8_t planes){
+  for(int plane = 0; plane < SCREEN_PLANES; plane++)
+    if(planes & (1 << plane)) vmem->fill(plane * PLANE_BYTES, PLANE_BYTES, 0);
+
+  this->dirty_rows = ~0ULL;
+  this->writes++;
 }
 
 /** Chip8::instr_00E0_CLS
     Clear the display.
 
+    Only the selected planes are cleared.
+
 */
-void chip8::instr_00E0_CLS(Memory * vmem){
-  for(int i = 0; i < 256; i++) vmem->write(i, 0);
+void chip8::instr_00E0_CLS(VideoMemory* vmem){
+  this->clear_screen(vmem, this->planes);
 }
 
 /** Chip8::instr_00EE_RET
@@ -98,8 +775,13 @@ void chip8::instr_00E0_CLS(Memory * vmem){
     address at the top of the stack, then subtracts 1
     from the stack pointer.
 
+    A return with an empty stack throws an error.
+
 */
 void chip8::instr_00EE_RET(){
+  if(this->SP == 0)
+    throw std::invalid_argument("Return with an empty stack");
+
   this->PC = this->stack[this->SP--];
 }
 
@@ -118,8 +800,13 @@ void chip8::instr_1nnn_JP(uint16_t nnn){
     The interpreter increments the stack pointer,
     then puts the current PC on the top of the stack.
     The PC is then set to nnn.
+
+    A call with a full stack throws an error.
 */
 void chip8::instr_2nnn_CALL(uint16_t nnn){
+  if(this->SP >= STACK_SIZE - 1)
+    throw std::invalid_argument("Stack overflow");
+
   this->stack[++this->SP] = this->PC;
   this->PC = nnn;
 }
@@ -132,8 +819,8 @@ void chip8::instr_2nnn_CALL(uint16_t nnn){
     counter by 2.
 
 */
-void chip8::instr_3xkk_SE(uint8_t x, uint8_t kk){
-  if(this->regs[x] == kk) this->PC += 2;
+void chip8::instr_3xkk_SE(uint8_t x, uint8_t kk, DataMemory* mem){
+  if(this->regs[x] == kk) this->skip_next(mem);
 }
 
 /** Chip8::instr_4xkk_SNE
@@ -144,8 +831,8 @@ void chip8::instr_3xkk_SE(uint8_t x, uint8_t kk){
     counter by 2.
 
 */
-void chip8::instr_4xkk_SNE(uint8_t x, uint8_t kk){
-  if(this->regs[x] != kk) this->PC += 2;
+void chip8::instr_4xkk_SNE(uint8_t x, uint8_t kk, DataMemory* mem){
+  if(this->regs[x] != kk) this->skip_next(mem);
 }
 
 /** Chip8::instr_5xy0_SE
@@ -156,8 +843,8 @@ void chip8::instr_4xkk_SNE(uint8_t x, uint8_t kk){
     counter by 2.
 
 */
-void chip8::instr_5xy0_SE(uint8_t x, uint8_t y){
-  if(this->regs[x] == this->regs[y]) this->PC += 2;
+void chip8::instr_5xy0_SE(uint8_t x, uint8_t y, DataMemory* mem){
+  if(this->regs[x] == this->regs[y]) this->skip_next(mem);
 }
 
 /** Chip8::instr_6xkk_LD
@@ -200,9 +887,13 @@ void chip8::instr_8xy0_LD(uint8_t x, uint8_t y){
     from two values, and if either bit is 1,
     then the same bit in the result is also 1. Otherwise, it is 0.
 
+    With logic_resets_vf, VF is then set to 0.
+
 */
+template<typename Q>
 void chip8::instr_8xy1_OR(uint8_t x, uint8_t y){
   this->regs[x] |= this->regs[y];
+  if(Q::logic_resets_vf) this->regs[15] = 0;
 }
 
 /** Chip8::instr_8xy2_AND
@@ -215,9 +906,13 @@ void chip8::instr_8xy1_OR(uint8_t x, uint8_t y){
     then the same bit in the result is also 1.
     Otherwise, it is 0.
 
+    With logic_resets_vf, VF is then set to 0.
+
 */
+template<typename Q>
 void chip8::instr_8xy2_AND(uint8_t x, uint8_t y){
   this->regs[x] &= this->regs[y];
+  if(Q::logic_resets_vf) this->regs[15] = 0;
 }
 
 /** Chip8::instr_8xy3_XOR
@@ -230,9 +925,13 @@ void chip8::instr_8xy2_AND(uint8_t x, uint8_t y){
     then the corresponding bit in the result is set to 1.
     Otherwise, it is 0.
 
+    With logic_resets_vf, VF is then set to 0.
+
 */
+template<typename Q>
 void chip8::instr_8xy3_XOR(uint8_t x, uint8_t y){
   this->regs[x] ^= this->regs[y];
+  if(Q::logic_resets_vf) this->regs[15] = 0;
 }
 
 /** Chip8::instr_8xy4_ADD
@@ -268,9 +967,12 @@ void chip8::instr_8xy5_SUB(uint8_t x, uint8_t y){
     If the least-significant bit of Vx is 1,
     then VF is set to 1, otherwise 0.
     Then Vx is divided by 2.
+    With shift_vy, Vy is first copied to Vx.
 
 */
+template<typename Q>
 void chip8::instr_8xy6_SHR(uint8_t x, uint8_t y){
+  if(Q::shift_vy) this->regs[x] = this->regs[y];
   this->regs[15] = (this->regs[x] & 0x01) ? 1 : 0;
   this->regs[x] >>= 1;
 }
@@ -293,9 +995,12 @@ void chip8::instr_8xy7_SUBN(uint8_t x, uint8_t y){
     If the most-significant bit of Vx is 1,
     then VF is set to 1, otherwise to 0.
     Then Vx is multiplied by 2.
+    With shift_vy, Vy is first copied to Vx.
 
 */
+template<typename Q>
 void chip8::instr_8xyE_SHL(uint8_t x, uint8_t y){
+  if(Q::shift_vy) this->regs[x] = this->regs[y];
   this->regs[15] = (this->regs[x] & 0x80) ? 1 : 0;
   this->regs[x] <<= 1;
 }
@@ -309,8 +1014,8 @@ void chip8::instr_8xyE_SHL(uint8_t x, uint8_t y){
 
 
 */
-void chip8::instr_9xy0_SNE(uint8_t x, uint8_t y){
-  if(this->regs[x] != this->regs[y]) this->PC += 2;
+void chip8::instr_9xy0_SNE(uint8_t x, uint8_t y, DataMemory* mem){
+  if(this->regs[x] != this->regs[y]) this->skip_next(mem);
 }
 
 /** Chip8::instr_Annn_LD
@@ -327,10 +1032,13 @@ void chip8::instr_Annn_LD(uint16_t nnn){
     Jump to location nnn + V0.
 
     The program counter is set to nnn plus the value of V0.
+    With jump_vx, the register is the one given by the highest
+    digit of nnn instead of V0.
 
 */
+template<typename Q>
 void chip8::instr_Bnnn_JP(uint16_t nnn){
-  this->PC = this->regs[0] + nnn;
+  this->PC = this->regs[Q::jump_vx ? (nnn >> 8) : 0] + nnn;
 }
 
 /** Chip8::instr_Cxkk_RND
@@ -343,7 +1051,7 @@ void chip8::instr_Bnnn_JP(uint16_t nnn){
 */
 void chip8::instr_Cxkk_RND(uint8_t x, uint8_t kk){
 
-  uint8_t rand = std::rand() % 256;
+  uint8_t rand = this->next_random() % 256;
   this->regs[x] = rand & kk;
 }
 
@@ -359,58 +1067,99 @@ void chip8::instr_Cxkk_RND(uint8_t x, uint8_t kk){
     VF is set to 1, otherwise it is set to 0.
     If the sprite is positioned so part of it is
     outside the coordinates of the display, it wraps
-    around to the opposite side of the screen
+    around to the opposite side of the screen; with sprites_clip,
+    the part outside is not drawn, only the first pixel wraps.
+    In high resolution, Dxy0 draws a 16x16 sprite, two bytes per row.
+    The sprite is drawn on each selected plane, the data of each
+    plane following the one of the previous plane in memory.
+
+    Each row of the screen is made of 64 bits words of vmem, and
+    pixel n of the row is bit n % 64 of word n / 64. A row of the
+    sprite is then mirrored (its msb is the leftmost pixel), moved
+    to column Vx, and XORed onto the row of the screen one word at
+    a time. In low resolution the row is a single word, and the
+    sprite is rotated into it, which also wraps it around.
 
 */
-void chip8::instr_Dxyn_DRW(uint8_t x, uint8_t y, uint8_t n, Memory* mem, Memory* vmem){
+template<typename Q>
+void chip8::instr_Dxyn_DRW(uint8_t x, uint8_t y, uint8_t n, DataMemory* mem, VideoMemory* vmem){
+
+  CHIP8_PROFILE_SCOPE(PROFILE_DRAW);
+
+  // Size of the screen in the current resolution
+  uint8_t width  = this->hires ? SCREEN_WIDTH  : SCREEN_WIDTH / 2;
+  uint8_t height = this->hires ? SCREEN_HEIGHT : SCREEN_HEIGHT / 2;
 
-  // Read the registers
-  uint8_t vx = this->regs[x];
-  uint8_t vy = this->regs[y];
+  // Coordinates of the first pixel, wrapping around the screen
+  uint8_t vx = this->regs[x] % width;
+  uint8_t vy = this->regs[y] % height;
 
-  // Flat to check collisions
-  uint8_t flag = 0;
+  // Size of the sprite
+  bool    big   = (n == 0 && this->hires);
+  uint8_t rows  = big ? 16 : n;
+  uint8_t bytes = big ? 2 : 1;
 
-  // For each of the n bytes
-  for(int i = 0; i < n; i++){
+  // Pixels erased by the sprite
+  uint64_t collision = 0;
 
-    // Get inital bit in the screen to draw
-    uint16_t vmem_addr_bit = (vy + i) * 64 + vx;
+  // Address of the data of the next plane drawn
+  uint16_t data = this->I;
 
-    // Read byte to write
-    uint8_t mem_data = mem->read(this->I + i);
+  for(int plane = 0; plane < SCREEN_PLANES; plane++){
 
-    // For each bit of the byte, msb first
-    for(int j = 7; j >= 0; j--){
+    if(!(this->planes & (1 << plane))) continue;
 
-      // Get address of the bytes in the video memory
-      uint16_t vmem_addr = vmem_addr_bit / 8;
+    // For each of the rows
+    for(int i = 0; i < rows; i++){
 
-      // Get position of the bit to write in vmem_addr
-      uint8_t vmem_data_bit = vmem_addr_bit % 8;
+      // The rows below the screen are cut
+      if(Q::sprites_clip && vy + i >= height) break;
 
-      // Read current value of vmem
-      uint8_t vmem_data = vmem->read(vmem_addr);
+      // Read the row, mirrored so that its leftmost pixel is bit 0
+      uint64_t sprite = mirror(mem->read(data + i * bytes));
+      if(big) sprite |= (uint64_t) mirror(mem->read(data + i * bytes + 1)) << 8;
 
-      // Possibly modify the vmem
-      if(mem_data & (1 << j)){
-        if(vmem_data & (1 << vmem_data_bit)) flag = 1;
-        vmem_data = (vmem_data ^ (1 << vmem_data_bit));
+      // Move it to column vx, the bits out of the row go back to its beginning,
+      // or are lost when cut
+      uint64_t word0, word1;
+
+      if(!this->hires){
+        if(Q::sprites_clip) word0 = sprite << vx;
+        else                word0 = (sprite << vx) | (sprite >> ((64 - vx) & 63));
+        word1 = 0;
+      }
+      else if(vx < 64){
+        word0 = sprite << vx;
+        word1 = (vx > 0) ? sprite >> (64 - vx) : 0;
       }
+      else{
+        word1 = sprite << (vx - 64);
+        word0 = (vx > 64 && !Q::sprites_clip) ? sprite >> (128 - vx) : 0;
+      }
+
+      // Address of the row in the video memory
+      uint8_t  row = (vy + i) % height;
+      uint16_t vmem_addr = plane * PLANE_BYTES + row * ROW_BYTES;
 
-      // Write the data back
-      vmem->write(vmem_addr, vmem_data);
+      uint64_t screen = vmem->read64(vmem_addr);
+      collision |= screen & word0;
+      vmem->write64(vmem_addr, screen ^ word0);
 
-      // Next bit
-      vmem_addr_bit++;
+      if(word1){
+        screen = vmem->read64(vmem_addr + 8);
+        collision |= screen & word1;
+        vmem->write64(vmem_addr + 8, screen ^ word1);
+      }
 
-      // Go at the beginning of the line if overflow
-      vmem_addr_bit = (vmem_addr_bit / 64 != (vy + i)) ? vmem_addr_bit - 64 : vmem_addr_bit;
+      if(word0 | word1) this->dirty_rows |= 1ULL << row;
     }
+
+    data += rows * bytes;
   }
 
   // Set collistion register
-  this->regs[0xf] = (flag) ? 1 : 0;
+  this->regs[0xf] = (collision) ? 1 : 0;
+  this->writes++;
 }
 
 /** Chip8::instr_Ex9E_SKP
@@ -421,8 +1170,8 @@ void chip8::instr_Dxyn_DRW(uint8_t x, uint8_t y, uint8_t n, Memory* mem, Memory*
     PC is increased by 2.
 
 */
-void chip8::instr_Ex9E_SKP(uint8_t x, uint16_t key){
-  if(key & (1 << this->regs[x])) this->PC += 2;
+void chip8::instr_Ex9E_SKP(uint8_t x, uint16_t key, DataMemory* mem){
+  if(key & (1 << this->regs[x])) this->skip_next(mem);
 }
 
 /** Chip8::instr_ExA1_SKNP
@@ -433,8 +1182,8 @@ void chip8::instr_Ex9E_SKP(uint8_t x, uint16_t key){
     PC is increased by 2.
 
 */
-void chip8::instr_ExA1_SKNP(uint8_t x, uint16_t key){
-  if((~key & (1 << this->regs[x]))) this->PC += 2;
+void chip8::instr_ExA1_SKNP(uint8_t x, uint16_t key, DataMemory* mem){
+  if((~key & (1 << this->regs[x]))) this->skip_next(mem);
 }
 
 /** Chip8::instr_Fx07_LD
@@ -458,7 +1207,7 @@ void chip8::instr_Fx0A_LD(uint8_t x, uint16_t key){
 
   // Go back of one step if no key is pressed
   if(key == 0){
-    this->PC -= 2, this->DT++, this->ST++;
+    this->PC -= 2;
   }
   else{
 
@@ -523,11 +1272,12 @@ void chip8::instr_Fx29_LD(uint8_t x){
     digit at location I+2.
 
 */
-void chip8::instr_Fx33_LD(uint8_t x, Memory* mem){
+void chip8::instr_Fx33_LD(uint8_t x, DataMemory* mem){
   uint8_t value = this->I;
   mem->write(this->I + 2, value % 10); value /= 10;
   mem->write(this->I + 1, value % 10); value /= 10;
   mem->write(this->I    , value % 10);
+  this->writes++;
 }
 
 /** Chip8::instr_Fx55_LD
@@ -535,10 +1285,14 @@ void chip8::instr_Fx33_LD(uint8_t x, Memory* mem){
 
     The interpreter copies the values of registers V0
     through Vx into memory, starting at the address in I.
+    With memory_moves_i, I is left after the last byte written.
 
 */
-void chip8::instr_Fx55_LD(uint8_t x, Memory* mem){
+template<typename Q>
+void chip8::instr_Fx55_LD(uint8_t x, DataMemory* mem){
   for(int i = 0; i <= x; i++) mem->write(this->I + i, this->regs[i]);
+  if(Q::memory_moves_i) this->I += x + 1;
+  this->writes++;
 }
 
 /** Chip8::instr_Fx65_LD
@@ -546,10 +1300,238 @@ void chip8::instr_Fx55_LD(uint8_t x, Memory* mem){
 
     The interpreter reads values from memory starting at location I
     into registers V0 through Vx.
+    With memory_moves_i, I is left after the last byte read.
 
 */
-void chip8::instr_Fx65_LD(uint8_t x, Memory* mem){
+template<typename Q>
+void chip8::instr_Fx65_LD(uint8_t x, DataMemory* mem){
   for(int i = 0; i <= x; i++) this->regs[i] = mem->read(this->I + i);
+  if(Q::memory_moves_i) this->I += x + 1;
+}
+
+/** Chip8::instr_00Cn_SCD
+    Scroll the display down by n pixels.
+
+    Each selected plane is moved down as a whole block of rows,
+    and the rows left at the top are cleared.
+
+*/
+void chip8::instr_00Cn_SCD(uint8_t n, VideoMemory* vmem){
+
+  uint8_t height = this->hires ? SCREEN_HEIGHT : SCREEN_HEIGHT / 2;
+  if(n > height) n = height;
+
+  for(int plane = 0; plane < SCREEN_PLANES; plane++){
+    if(!(this->planes & (1 << plane))) continue;
+
+    uint16_t base = plane * PLANE_BYTES;
+    vmem->move(base + n * ROW_BYTES, base, (height - n) * ROW_BYTES);
+    vmem->fill(base, n * ROW_BYTES, 0);
+  }
+
+  this->dirty_rows = ~0ULL;
+  this->writes++;
+}
+
+/** Chip8::instr_00Dn_SCU
+    Scroll the display up by n pixels.
+
+    Each selected plane is moved up as a whole block of rows,
+    and the rows left at the bottom are cleared.
+
+*/
+void chip8::instr_00Dn_SCU(uint8_t n, VideoMemory* vmem){
+
+  uint8_t height = this->hires ? SCREEN_HEIGHT : SCREEN_HEIGHT / 2;
+  if(n > height) n = height;
+
+  for(int plane = 0; plane < SCREEN_PLANES; plane++){
+    if(!(this->planes & (1 << plane))) continue;
+
+    uint16_t base = plane * PLANE_BYTES;
+    vmem->move(base, base + n * ROW_BYTES, (height - n) * ROW_BYTES);
+    vmem->fill(base + (height - n) * ROW_BYTES, n * ROW_BYTES, 0);
+  }
+
+  this->dirty_rows = ~0ULL;
+  this->writes++;
+}
+
+/** Chip8::instr_00FB_SCR
+    Scroll the display right by 4 pixels.
+
+    Since pixel n of a row is bit n of its words, each row is
+    shifted left, the bits leaving the first word entering the second.
+
+*/
+void chip8::instr_00FB_SCR(VideoMemory* vmem){
+
+  uint8_t height = this->hires ? SCREEN_HEIGHT : SCREEN_HEIGHT / 2;
+
+  for(int plane = 0; plane < SCREEN_PLANES; plane++){
+    if(!(this->planes & (1 << plane))) continue;
+
+    for(int row = 0; row < height; row++){
+      uint16_t addr = plane * PLANE_BYTES + row * ROW_BYTES;
+      uint64_t word0 = vmem->read64(addr);
+
+      if(this->hires) vmem->write64(addr + 8, vmem->read64(addr + 8) << 4 | word0 >> 60);
+      vmem->write64(addr, word0 << 4);
+    }
+  }
+
+  this->dirty_rows = ~0ULL;
+  this->writes++;
+}
+
+/** Chip8::instr_00FC_SCL
+    Scroll the display left by 4 pixels.
+
+    Each row is shifted right, the bits leaving the
+    second word entering the first.
+
+*/
+void chip8::instr_00FC_SCL(VideoMemory* vmem){
+
+  uint8_t height = this->hires ? SCREEN_HEIGHT : SCREEN_HEIGHT / 2;
+
+  for(int plane = 0; plane < SCREEN_PLANES; plane++){
+    if(!(this->planes & (1 << plane))) continue;
+
+    for(int row = 0; row < height; row++){
+      uint16_t addr = plane * PLANE_BYTES + row * ROW_BYTES;
+      uint64_t word0 = vmem->read64(addr) >> 4;
+
+      if(this->hires){
+        uint64_t word1 = vmem->read64(addr + 8);
+        word0 |= word1 << 60;
+        vmem->write64(addr + 8, word1 >> 4);
+      }
+      vmem->write64(addr, word0);
+    }
+  }
+
+  this->dirty_rows = ~0ULL;
+  this->writes++;
+}
+
+/** Chip8::instr_00FD_EXIT
+    Exit the interpreter.
+
+    The program stops: PC stays on this instruction.
+
+*/
+void chip8::instr_00FD_EXIT(){
+  this->PC -= 2;
+}
+
+/** Chip8::instr_00FE_LOW
+    Switch to low resolution, 64x32.
+
+    The whole screen is cleared.
+
+*/
+void chip8::instr_00FE_LOW(VideoMemory* vmem){
+  this->hires = false;
+  this->clear_screen(vmem, (1 << SCREEN_PLANES) - 1);
+}
+
+/** Chip8::instr_00FF_HIGH
+    Switch to high resolution, 128x64.
+
+    The whole screen is cleared.
+
+*/
+void chip8::instr_00FF_HIGH(VideoMemory* vmem){
+  this->hires = true;
+  this->clear_screen(vmem, (1 << SCREEN_PLANES) - 1);
+}
+
+/** Chip8::instr_5xy2_LD
+    Store registers Vx through Vy in memory starting at location I.
+
+    The registers are stored in descending order if x > y.
+    I is not changed.
+
+*/
+void chip8::instr_5xy2_LD(uint8_t x, uint8_t y, DataMemory* mem){
+  int step = (x <= y) ? 1 : -1;
+  for(int i = 0; i <= abs(y - x); i++) mem->write(this->I + i, this->regs[x + i * step]);
+  this->writes++;
+}
+
+/** Chip8::instr_5xy3_LD
+    Read registers Vx through Vy from memory starting at location I.
+
+    The registers are read in descending order if x > y.
+    I is not changed.
+
+*/
+void chip8::instr_5xy3_LD(uint8_t x, uint8_t y, DataMemory* mem){
+  int step = (x <= y) ? 1 : -1;
+  for(int i = 0; i <= abs(y - x); i++) this->regs[x + i * step] = mem->read(this->I + i);
+}
+
+/** Chip8::instr_F000_LD
+    Set I = nnnn, the 16 bits word following the instruction.
+
+    The instruction is 4 bytes long, and PC is moved after nnnn.
+
+*/
+void chip8::instr_F000_LD(DataMemory* mem){
+  this->I = mem->read(this->PC) << 8 | mem->read(this->PC + 1);
+  this->PC += 2;
+}
+
+/** Chip8::instr_Fn01_PLANE
+    Select the planes drawn, cleared and scrolled.
+
+    Bit p of n selects plane p.
+
+*/
+void chip8::instr_Fn01_PLANE(uint8_t n){
+  this->planes = n & ((1 << SCREEN_PLANES) - 1);
+}
+
+/** Chip8::instr_Fx30_LD
+    Set I = location of the 8x10 sprite for digit Vx.
+
+*/
+void chip8::instr_Fx30_LD(uint8_t x){
+  this->I = BIG_FONT_ADDRESS + (this->regs[x] & 0x0f) * 10;
+}
+
+/** Chip8::instr_Fx75_LD
+    Store registers V0 through Vx in the flags.
+
+*/
+void chip8::instr_Fx75_LD(uint8_t x){
+  for(int i = 0; i <= x; i++) this->flags[i] = this->regs[i];
+  this->writes++;
+}
+
+/** Chip8::instr_Fx85_LD
+    Read registers V0 through Vx from the flags.
+
+*/
+void chip8::instr_Fx85_LD(uint8_t x){
+  for(int i = 0; i <= x; i++) this->regs[i] = this->flags[i];
+}
+
+/** Chip8::instr_F002_LD
+    Read the audio pattern from memory starting at location I.
+
+*/
+void chip8::instr_F002_LD(DataMemory* mem){
+  for(int i = 0; i < AUDIO_PATTERN_SIZE; i++) this->pattern[i] = mem->read(this->I + i);
+}
+
+/** Chip8::instr_Fx3A_PITCH
+    Set the pitch of the audio pattern = Vx.
+
+*/
+void chip8::instr_Fx3A_PITCH(uint8_t x){
+  this->pitch = this->regs[x];
 }
 
 /** Chip8::init
@@ -558,7 +1540,10 @@ void chip8::instr_Fx65_LD(uint8_t x, Memory* mem){
 */
 void chip8::init(){
 
-  srand(time(0));
+  this->set_seed(time(0));
+
+  // Decode table used by the dispatch
+  this->decode_table = build_decode_table();
 
   // Reset all the registers
   for(int i = 0; i < 16; i++) this->regs[i] = 0;
@@ -569,9 +1554,307 @@ void chip8::init(){
   this->PC = 0x200;
 
   // Reset stack
-  for(int i = 0; i < 64; i++) this->stack[i] = 0;
+  for(int i = 0; i < STACK_SIZE; i++) this->stack[i] = 0;
 
   // Reset timers
   this->DT = 0;
   this->ST = 0;
+
+  // Low resolution, drawing on the first plane only
+  this->hires = false;
+  this->planes = 1;
+
+  // Until a rom loads its own pattern, the buzzer is a 500 Hz square wave
+  for(int i = 0; i < AUDIO_PATTERN_SIZE; i++) this->pattern[i] = 0xf0;
+  this->pitch = AUDIO_DEFAULT_PITCH;
+  for(int i = 0; i < 16; i++) this->flags[i] = 0;
+
+  // The whole screen has to be shown
+  this->dirty_rows = ~0ULL;
+
+  this->set_quirks(QUIRKS_LEGACY);
+  this->idle_detection = true;
+  this->idle = IDLE_NONE;
+  this->idle_pc = IDLE_NO_JUMP;
+  this->writes = 0;
+
+#ifdef CHIP8_JIT
+  this->jit_enabled = this->jit.available();
+#endif
+}
+
+/** Chip8::set_seed
+    Seed the random number generator of the CPU.
+    Each CPU has its own generator, so that runs with
+    the same seed give the same result, even when
+    several CPUs run at the same time.
+
+    @param seed uint32_t seed to use
+*/
+void chip8::set_seed(uint32_t seed){
+
+  // xorshift cannot leave the all zeros state
+  this->rng = (seed != 0) ? seed : 0x9e3779b9;
+}
+
+/** Chip8::next_random
+    Get the next number from the random number generator.
+
+    @return uint32_t random number
+*/
+uint32_t chip8::next_random(){
+  this->rng ^= this->rng << 13;
+  this->rng ^= this->rng >> 17;
+  this->rng ^= this->rng << 5;
+  return this->rng;
+}
+
+/** Chip8::set_jit
+    Enable or disable the execution of translated code.
+    It has no effect if the emulator is built without CHIP8_JIT,
+    or if the host cannot run translated code.
+
+    @param enable bool whether to use the translated code
+*/
+void chip8::set_jit(bool enable){
+#ifdef CHIP8_JIT
+  this->jit_enabled = enable && this->jit.available();
+#else
+  (void) enable;
+#endif
+}
+
+/** Chip8::set_quirks
+    Select the behavior of the instructions which differ between
+    interpreters, i.e. the instantiation of the interpreter run.
+
+    @param quirks uint8_t chip8_quirks of the profile to use
+*/
+void chip8::set_quirks(uint8_t quirks){
+
+  // Interpreters, and their execute stages, in the order of chip8_quirks
+  static void (chip8::* const interpreters[QUIRKS_COUNT])(DataMemory*, VideoMemory*, uint16_t, uint32_t) = {
+    &chip8::run_impl<quirks_legacy>,
+    &chip8::run_impl<quirks_vip>,
+    &chip8::run_impl<quirks_schip>,
+    &chip8::run_impl<quirks_modern>,
+  };
+
+  static void (chip8::* const executes[QUIRKS_COUNT])(uint16_t, DataMemory*, VideoMemory*, uint16_t) = {
+    &chip8::execute_impl<quirks_legacy>,
+    &chip8::execute_impl<quirks_vip>,
+    &chip8::execute_impl<quirks_schip>,
+    &chip8::execute_impl<quirks_modern>,
+  };
+
+  if(quirks >= QUIRKS_COUNT){
+    throw std::invalid_argument("Quirks profile not valid");
+  }
+
+  this->quirks = quirks;
+  this->run_fn = interpreters[quirks];
+  this->execute_fn = executes[quirks];
+}
+
+/** Chip8::get_quirks
+    Get the quirks profile in use.
+
+    @return uint8_t chip8_quirks of the profile
+*/
+uint8_t chip8::get_quirks(){
+  return this->quirks;
+}
+
+/** Chip8::set_idle_detection
+    Enable or disable the skipping of idle loops by chip8::run,
+    e.g. to measure the speed of loops which do nothing.
+
+    @param enable bool whether to skip the idle loops
+*/
+void chip8::set_idle_detection(bool enable){
+  this->idle_detection = enable;
+}
+
+/** Chip8::get_idle
+    Tell whether the last run ended in an idle loop,
+    and what can make the CPU leave it.
+
+    @return uint8_t chip8_idle state of the CPU
+*/
+uint8_t chip8::get_idle(){
+  return this->idle;
+}
+
+/** Chip8::tick_timers
+    Decrement the delay and sound timers, if not zero yet.
+    To be called at 60 Hz of emulated time.
+
+*/
+void chip8::tick_timers(){
+  if(this->DT > 0) this->DT--;
+  if(this->ST > 0) this->ST--;
+}
+
+/** Chip8::sound_on
+    Check whether the buzzer is sounding.
+
+    @return bool whether the sound timer is not zero
+*/
+bool chip8::sound_on(){
+  return this->ST > 0;
+}
+
+/** Chip8::get_pitch
+    Return the pitch of the audio pattern
+
+    @return uint8_t pitch, 64 for 4000 samples per second
+*/
+uint8_t chip8::get_pitch(){
+  return this->pitch;
+}
+
+/** Chip8::get_pattern
+    Return the audio pattern played while the buzzer is sounding
+
+    @return const uint8_t* AUDIO_PATTERN_SIZE bytes, 1 bit per sample, msb first
+*/
+const uint8_t* chip8::get_pattern(){
+  return this->pattern;
+}
+
+/** Chip8::regs_dump
+    Print the content of the registers on the standard output
+
+*/
+void chip8::regs_dump(){
+
+  std::ios_base::fmtflags flags = std::cout.flags();
+  std::cout << std::hex << std::setfill('0');
+
+  for(int i = 0; i < 16; i++)
+    std::cout << "V" << std::uppercase << i << std::nouppercase << "=" << std::setw(2) << (int) this->regs[i] << " ";
+
+  std::cout << std::endl
+            << "I="  << std::setw(4) << this->I  << " "
+            << "PC=" << std::setw(4) << this->PC << " "
+            << "SP=" << std::setw(2) << (int) this->SP << " "
+            << "DT=" << std::setw(2) << (int) this->DT << " "
+            << "ST=" << std::setw(2) << (int) this->ST << std::endl;
+
+  std::cout.flags(flags);
+}
+
+/** Chip8::get_PC
+    Return the program counter
+
+    @return uint16_t address of the next instruction
+*/
+uint16_t chip8::get_PC(){
+  return this->PC;
+}
+
+/** Chip8::is_hires
+    Tell the resolution of the screen
+
+    @return bool whether the screen is 128x64, instead of 64x32
+*/
+bool chip8::is_hires(){
+  return this->hires;
+}
+
+/** Chip8::take_dirty_rows
+    Return which rows of the screen changed since the last call,
+    and start tracking the changes again.
+
+    @return uint64_t mask with bit n set if row n changed
+*/
+uint64_t chip8::take_dirty_rows(){
+  uint64_t rows = this->dirty_rows;
+  this->dirty_rows = 0;
+  return rows;
+}
+
+/** Chip8::hash
+    Add the state of the CPU to a FNV-1a hash.
+
+    @param h uint64_t hash so far
+    @return uint64_t updated hash
+*/
+uint64_t chip8::hash(uint64_t h){
+
+  auto add = [&h](uint64_t value, int bytes){
+    for(int i = 0; i < bytes; i++){
+      h ^= (value >> (8 * i)) & 0xff;
+      h *= FNV_PRIME;
+    }
+  };
+
+  for(int i = 0; i < 16; i++) add(this->regs[i], 1);
+  add(this->I, 2);
+  add(this->PC, 2);
+  add(this->SP, 1);
+  for(int i = 0; i < STACK_SIZE; i++) add(this->stack[i], 2);
+  add(this->DT, 1);
+  add(this->ST, 1);
+  add(this->rng, 4);
+  add(this->hires, 1);
+  add(this->planes, 1);
+  for(int i = 0; i < 16; i++) add(this->flags[i], 1);
+  for(int i = 0; i < AUDIO_PATTERN_SIZE; i++) add(this->pattern[i], 1);
+  add(this->pitch, 1);
+
+  return h;
+}
+
+/** Chip8::save_state
+    Write the state of the CPU, CHIP8_STATE_SIZE bytes in the
+    same order as chip8::hash, least significant byte first.
+
+    @param out uint8_t* where to write the state
+*/
+void chip8::save_state(uint8_t* out){
+
+  for(int i = 0; i < 16; i++) out = Snapshot::put(out, this->regs[i], 1);
+  out = Snapshot::put(out, this->I, 2);
+  out = Snapshot::put(out, this->PC, 2);
+  out = Snapshot::put(out, this->SP, 1);
+  for(int i = 0; i < STACK_SIZE; i++) out = Snapshot::put(out, this->stack[i], 2);
+  out = Snapshot::put(out, this->DT, 1);
+  out = Snapshot::put(out, this->ST, 1);
+  out = Snapshot::put(out, this->rng, 4);
+  out = Snapshot::put(out, this->hires, 1);
+  out = Snapshot::put(out, this->planes, 1);
+  for(int i = 0; i < 16; i++) out = Snapshot::put(out, this->flags[i], 1);
+  for(int i = 0; i < AUDIO_PATTERN_SIZE; i++) out = Snapshot::put(out, this->pattern[i], 1);
+  out = Snapshot::put(out, this->pitch, 1);
+}
+
+/** Chip8::load_state
+    Read the state of the CPU written by chip8::save_state.
+    The whole screen is marked as changed.
+
+    @param in const uint8_t* where to read the state
+*/
+void chip8::load_state(const uint8_t* in){
+
+  uint64_t value;
+
+  for(int i = 0; i < 16; i++) in = Snapshot::get(in, &value, 1), this->regs[i] = value;
+  in = Snapshot::get(in, &value, 2), this->I = value;
+  in = Snapshot::get(in, &value, 2), this->PC = value;
+  in = Snapshot::get(in, &value, 1), this->SP = value;
+
+  if(this->SP >= STACK_SIZE)
+    throw std::invalid_argument("Stack pointer of the snapshot not valid");
+  for(int i = 0; i < STACK_SIZE; i++) in = Snapshot::get(in, &value, 2), this->stack[i] = value;
+  in = Snapshot::get(in, &value, 1), this->DT = value;
+  in = Snapshot::get(in, &value, 1), this->ST = value;
+  in = Snapshot::get(in, &value, 4), this->rng = value;
+  in = Snapshot::get(in, &value, 1), this->hires = value;
+  in = Snapshot::get(in, &value, 1), this->planes = value;
+  for(int i = 0; i < 16; i++) in = Snapshot::get(in, &value, 1), this->flags[i] = value;
+  for(int i = 0; i < AUDIO_PATTERN_SIZE; i++) in = Snapshot::get(in, &value, 1), this->pattern[i] = value;
+  in = Snapshot::get(in, &value, 1), this->pitch = value;
+
+  this->dirty_rows = ~0ULL;
 }
@@ -3,8 +3,165 @@
 
 #include <stdint.h>
 #include "memory.h"
+#include "jit.h"
+#include "quirks.h"
 #include <ctime>
 #include <cstdlib>
+#include <vector>
+
+// Identifiers of the instructions, as produced by the decode stage
+enum chip8_opcode : uint8_t {
+  OP_INVALID = 0,
+  OP_00E0_CLS,  OP_00EE_RET,   OP_1nnn_JP,   OP_2nnn_CALL,
+  OP_3xkk_SE,   OP_4xkk_SNE,   OP_5xy0_SE,   OP_6xkk_LD,
+  OP_7xkk_ADD,  OP_8xy0_LD,    OP_8xy1_OR,   OP_8xy2_AND,
+  OP_8xy3_XOR,  OP_8xy4_ADD,   OP_8xy5_SUB,  OP_8xy6_SHR,
+  OP_8xy7_SUBN, OP_8xyE_SHL,   OP_9xy0_SNE,  OP_Annn_LD,
+  OP_Bnnn_JP,   OP_Cxkk_RND,   OP_Dxyn_DRW,  OP_Ex9E_SKP,
+  OP_ExA1_SKNP, OP_Fx07_LD,    OP_Fx0A_LD,   OP_Fx15_LD,
+  OP_Fx18_LD,   OP_Fx1E_ADD,   OP_Fx29_LD,   OP_Fx33_LD,
+  OP_Fx55_LD,   OP_Fx65_LD,
+
+  // SUPER-CHIP and XO-CHIP extensions
+  OP_00Cn_SCD,  OP_00Dn_SCU,   OP_00FB_SCR,  OP_00FC_SCL,
+  OP_00FD_EXIT, OP_00FE_LOW,   OP_00FF_HIGH, OP_5xy2_LD,
+  OP_5xy3_LD,   OP_F000_LD,    OP_Fn01_PLANE, OP_Fx30_LD,
+  OP_Fx75_LD,   OP_Fx85_LD,    OP_F002_LD,   OP_Fx3A_PITCH,
+  OP_COUNT,
+
+  // Sequences of instructions found by the decode cache,
+  // which chip8::run executes as a single instruction
+  OP_Annn_Dxyn = OP_COUNT, OP_6xkk_6xkk,
+  OP_7xkk_3xkk_1nnn,       OP_7xkk_4xkk_1nnn,
+  OP_Fx07_3xkk_1nnn,       OP_Fx07_4xkk_1nnn,
+  OP_FUSED_COUNT,
+
+  // Entry of the decode cache still to be filled
+  OP_UNCACHED = 0xff
+};
+
+// Frequency of the delay and sound timers
+#define TIMER_HZ 60
+
+// Default speed of the CPU, in instructions per second
+#define DEFAULT_IPS 700
+
+// Entries of the stack; 2nnn increments SP before storing,
+// so entry 0 is never used and SP goes up to STACK_SIZE - 1
+#define STACK_SIZE 64
+
+// Bytes of the state of the CPU in a snapshot
+#define CHIP8_STATE_SIZE (16 + 2 + 2 + 1 + 2 * STACK_SIZE + 1 + 1 + 4 + 1 + 1 + 16 + 16 + 1)
+
+// What can make the CPU leave the idle loop it ended a run in
+enum chip8_idle : uint8_t {
+  IDLE_NONE = 0,
+
+  // A loop polling the delay timer, or any loop which only reads the
+  // timers or the keys: it can change at the next tick
+  IDLE_TIMER,
+
+  // Fx0A waiting for a key, or a jump to itself: only the keys matter
+  IDLE_KEY
+};
+
+// Bytes of the XO-CHIP audio pattern, 128 samples of 1 bit
+#define AUDIO_PATTERN_SIZE 16
+
+// Value of the pitch register for 4000 samples per second of the pattern
+#define AUDIO_DEFAULT_PITCH 64
+
+// Value of chip8::idle_pc when no jump was seen in the current run
+#define IDLE_NO_JUMP 0xffff
+
+// Number of addresses covered by the decode cache
+#define DECODE_CACHE_SIZE DATA_MEMORY_SIZE
+
+// The entries of the decode cache grow by this many addresses
+#define DECODE_CACHE_STEP 1024
+
+// Bytes of the longest sequence of instructions fused by the decode cache
+#define DECODE_FUSED_SIZE 6
+
+// Instruction in the decode cache, with its fields already extracted.
+// fused is the opcode dispatched by chip8::run: the one of the
+// instruction, or the one of the sequence starting with it.
+struct chip8_decoded {
+  uint8_t  op;
+  uint8_t  x;
+  uint8_t  y;
+  uint8_t  n;
+  uint8_t  kk;
+  uint8_t  fused;
+  uint16_t nnn;
+};
+
+// Decoded instructions of a data memory, indexed by address.
+// The cache observes the memory, so that each entry is
+// dropped as soon as one of the bytes it was built from is written.
+// The entries are allocated up to the highest address decoded so
+// far, so that a CPU only holds the entries of the code it runs.
+class chip8_decode_cache : public MemoryObserver {
+  DataMemory* mem;
+
+  // Notified as well when entries are dropped, if set
+  MemoryObserver* next;
+
+  // Entries from address 0, and the entry of the addresses past them
+  std::vector<chip8_decoded> entries;
+  static const chip8_decoded uncached;
+
+  chip8_decoded*      writable(uint16_t);
+  void                fuse(uint16_t, const uint8_t*);
+
+public:
+                      chip8_decode_cache();
+                      chip8_decode_cache(const chip8_decode_cache&);
+  chip8_decode_cache& operator=(const chip8_decode_cache&);
+                      ~chip8_decode_cache();
+  bool                is_attached(DataMemory*);
+  void                attach(DataMemory*);
+  void                chain(MemoryObserver*);
+  const chip8_decoded* at(uint16_t);
+  const chip8_decoded* data();
+  uint32_t            size();
+  void                fill(uint16_t, const uint8_t*);
+  void                invalidate(uint16_t, uint32_t);
+  void                on_write(uint16_t, uint32_t) override;
+  void                on_detach(const void*) override;
+};
+
+/** Chip8_decode_cache::at
+    Get the entry of an address, OP_UNCACHED if not filled yet.
+    The entry is valid until the next call to fill.
+
+    @param addr uint16_t address of the instruction
+    @return const chip8_decoded* entry of the address
+*/
+inline const chip8_decoded* chip8_decode_cache::at(uint16_t addr){
+  if(addr >= this->entries.size()) return &uncached;
+  return &this->entries[addr];
+}
+
+/** Chip8_decode_cache::data
+    Get the entries allocated, from address 0.
+    They are valid until the next call to fill.
+
+    @return const chip8_decoded* first entry
+*/
+inline const chip8_decoded* chip8_decode_cache::data(){
+  return this->entries.data();
+}
+
+/** Chip8_decode_cache::size
+    Get the number of entries allocated; the addresses
+    from there are not filled yet.
+
+    @return uint32_t number of entries
+*/
+inline uint32_t chip8_decode_cache::size(){
+  return this->entries.size();
+}
 
 class chip8 {
 
@@ -21,52 +178,162 @@ class chip8 {
   uint8_t SP;
 
   // Stack
-  uint16_t stack[64];
+  uint16_t stack[STACK_SIZE];
 
   // Timers
   uint8_t DT;
   uint8_t ST;
 
+  // State of the random number generator (xorshift32)
+  uint32_t rng;
+
+  // Whether the screen is in high resolution, 128x64 instead of 64x32
+  bool hires;
+
+  // Mask of the planes drawn, cleared and scrolled
+  uint8_t planes;
+
+  // Registers saved by Fx75, the HP 48 flags of SUPER-CHIP
+  uint8_t flags[16];
+
+  // XO-CHIP audio: pattern played in a loop while ST is not zero,
+  // msb first, at 4000 * 2^((pitch - 64) / 48) samples per second
+  uint8_t pattern[AUDIO_PATTERN_SIZE];
+  uint8_t pitch;
+
+  // Rows of the screen changed since the last call to take_dirty_rows,
+  // bit n being set if row n was drawn, cleared or scrolled
+  uint64_t dirty_rows;
+
+  // Number of instructions which wrote to the data or video memory
+  uint32_t writes;
+
+  // Idle loop detection: state of the CPU at the last backward jump
+  // of the current run, with the instructions left at that point
+  bool     idle_detection;
+  uint8_t  idle;
+  uint16_t idle_pc;
+  uint32_t idle_cycles;
+  uint32_t idle_writes;
+  uint8_t  idle_regs[16];
+  uint16_t idle_I;
+  uint8_t  idle_SP;
+  uint16_t idle_stack[STACK_SIZE];
+  uint8_t  idle_DT;
+  uint8_t  idle_ST;
+  uint32_t idle_rng;
+  uint8_t  idle_planes;
+
+  // Table mapping each 16 bits instruction to its chip8_opcode
+  const uint8_t* decode_table;
+
+  // Already decoded instructions of the data memory
+  chip8_decode_cache icache;
+
+#ifdef CHIP8_JIT
+  // Translator of the instructions to native code
+  chip8_jit jit;
+  bool jit_enabled;
+#endif
+
+  // Interpreter of the quirks profile in use, and its execute stage alone
+  uint8_t quirks;
+  void (chip8::*run_fn)(DataMemory*, VideoMemory*, uint16_t, uint32_t);
+  void (chip8::*execute_fn)(uint16_t, DataMemory*, VideoMemory*, uint16_t);
+
+  template<typename Q> void run_impl(DataMemory*, VideoMemory*, uint16_t, uint32_t);
+  template<typename Q> void execute_impl(uint16_t, DataMemory*, VideoMemory*, uint16_t);
+
+  uint32_t next_random();
+  uint32_t skip_idle(uint32_t);
+  void execute(uint16_t, DataMemory*, VideoMemory*, uint16_t);
+  void skip_next(DataMemory*);
+  void clear_screen(VideoMemory*, uint8_t);
+
+  static uint8_t decode(uint16_t);
+  static const uint8_t* build_decode_table();
+
   // Instructions
-  void instr_00E0_CLS(Memory*);
+  void instr_00E0_CLS(VideoMemory*);
   void instr_00EE_RET();
   void instr_1nnn_JP(uint16_t);
   void instr_2nnn_CALL(uint16_t);
-  void instr_3xkk_SE(uint8_t, uint8_t);
-  void instr_4xkk_SNE(uint8_t, uint8_t);
-  void instr_5xy0_SE(uint8_t, uint8_t);
+  void instr_3xkk_SE(uint8_t, uint8_t, DataMemory*);
+  void instr_4xkk_SNE(uint8_t, uint8_t, DataMemory*);
+  void instr_5xy0_SE(uint8_t, uint8_t, DataMemory*);
   void instr_6xkk_LD(uint8_t, uint8_t);
   void instr_7xkk_ADD(uint8_t, uint8_t);
   void instr_8xy0_LD(uint8_t, uint8_t);
-  void instr_8xy1_OR(uint8_t, uint8_t);
-  void instr_8xy2_AND(uint8_t, uint8_t);
-  void instr_8xy3_XOR(uint8_t, uint8_t);
+  template<typename Q> void instr_8xy1_OR(uint8_t, uint8_t);
+  template<typename Q> void instr_8xy2_AND(uint8_t, uint8_t);
+  template<typename Q> void instr_8xy3_XOR(uint8_t, uint8_t);
   void instr_8xy4_ADD(uint8_t, uint8_t);
   void instr_8xy5_SUB(uint8_t, uint8_t);
-  void instr_8xy6_SHR(uint8_t, uint8_t);
+  template<typename Q> void instr_8xy6_SHR(uint8_t, uint8_t);
   void instr_8xy7_SUBN(uint8_t, uint8_t);
-  void instr_8xyE_SHL(uint8_t, uint8_t);
-  void instr_9xy0_SNE(uint8_t, uint8_t);
+  template<typename Q> void instr_8xyE_SHL(uint8_t, uint8_t);
+  void instr_9xy0_SNE(uint8_t, uint8_t, DataMemory*);
   void instr_Annn_LD(uint16_t);
-  void instr_Bnnn_JP(uint16_t);
+  template<typename Q> void instr_Bnnn_JP(uint16_t);
   void instr_Cxkk_RND(uint8_t, uint8_t);
-  void instr_Dxyn_DRW(uint8_t, uint8_t, uint8_t, Memory*, Memory*);
-  void instr_Ex9E_SKP(uint8_t, uint16_t);
-  void instr_ExA1_SKNP(uint8_t, uint16_t);
+  template<typename Q> void instr_Dxyn_DRW(uint8_t, uint8_t, uint8_t, DataMemory*, VideoMemory*);
+  void instr_Ex9E_SKP(uint8_t, uint16_t, DataMemory*);
+  void instr_ExA1_SKNP(uint8_t, uint16_t, DataMemory*);
   void instr_Fx07_LD(uint8_t);
   void instr_Fx0A_LD(uint8_t, uint16_t);
   void instr_Fx15_LD(uint8_t);
   void instr_Fx18_LD(uint8_t);
   void instr_Fx1E_ADD(uint8_t);
   void instr_Fx29_LD(uint8_t);
-  void instr_Fx33_LD(uint8_t, Memory*);
-  void instr_Fx55_LD(uint8_t, Memory*);
-  void instr_Fx65_LD(uint8_t, Memory*);
+  void instr_Fx33_LD(uint8_t, DataMemory*);
+  template<typename Q> void instr_Fx55_LD(uint8_t, DataMemory*);
+  template<typename Q> void instr_Fx65_LD(uint8_t, DataMemory*);
+  void instr_00Cn_SCD(uint8_t, VideoMemory*);
+  void instr_00Dn_SCU(uint8_t, VideoMemory*);
+  void instr_00FB_SCR(VideoMemory*);
+  void instr_00FC_SCL(VideoMemory*);
+  void instr_00FD_EXIT();
+  void instr_00FE_LOW(VideoMemory*);
+  void instr_00FF_HIGH(VideoMemory*);
+  void instr_5xy2_LD(uint8_t, uint8_t, DataMemory*);
+  void instr_5xy3_LD(uint8_t, uint8_t, DataMemory*);
+  void instr_F000_LD(DataMemory*);
+  void instr_Fn01_PLANE(uint8_t);
+  void instr_Fx30_LD(uint8_t);
+  void instr_Fx75_LD(uint8_t);
+  void instr_Fx85_LD(uint8_t);
+  void instr_F002_LD(DataMemory*);
+  void instr_Fx3A_PITCH(uint8_t);
+
+  // Lanes of the lockstep core are run through the instr_* methods
+  friend class chip8_lockstep;
+
+  // Roms translated ahead of time run on the state of the CPU
+  friend struct chip8_aot;
 
 public:
-  void step(Memory*, Memory*, uint16_t);
+  void step(DataMemory*, VideoMemory*, uint16_t);
+  void run(DataMemory*, VideoMemory*, uint16_t, uint32_t);
   void init();
+  void tick_timers();
+  bool sound_on();
+  uint8_t get_pitch();
+  const uint8_t* get_pattern();
+  void set_jit(bool);
+  void set_quirks(uint8_t);
+  uint8_t get_quirks();
+  void set_idle_detection(bool);
+  uint8_t get_idle();
+  void set_seed(uint32_t);
   void regs_dump();
+  uint16_t get_PC();
+  bool is_hires();
+  uint64_t take_dirty_rows();
+  uint64_t hash(uint64_t);
+  void save_state(uint8_t*);
+  void load_state(const uint8_t*);
+
+  static void split(uint16_t, const uint8_t*, chip8_decoded*);
 };
 
 #endif // !__CHIP8_H
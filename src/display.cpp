@@ -1,14 +1,17 @@
 #include "display.h"
 #include <iostream>
+#include <algorithm>
 
 
 /** Display_chip8::Display_chip8
     Constructor of the class.
     Creates the window and the renderer for SDL2
 
-    The window is 64x32, scaled by an integer factor SCALE_FACTOR.
-    In this way, each pixel from chip8 is mapped into a square
-    of size SCALE_FACTOR x SCALE_FACTOR
+    The window is 128x64, scaled by an integer factor SCALE_FACTOR.
+    The screen is kept in a 128x64 streaming texture, which
+    the renderer scales to the window, so that each pixel
+    from chip8 is mapped into a square of size SCALE_FACTOR x SCALE_FACTOR,
+    or twice as large in low resolution.
 
 */
 Display_chip8::Display_chip8() {
@@ -21,6 +24,22 @@ Display_chip8::Display_chip8() {
                               WINDOW_HEIGHT * SCALE_FACTOR,
                               0, &this->window, &this->renderer);
 
+  // Keep the pixels sharp when scaling
+  SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+
+  // Create the texture holding the screen
+  this->texture = SDL_CreateTexture(this->renderer,
+                                    SDL_PIXELFORMAT_ARGB8888,
+                                    SDL_TEXTUREACCESS_STREAMING,
+                                    WINDOW_WIDTH, WINDOW_HEIGHT);
+
+  if(!this->window || !this->renderer || !this->texture){
+    throw std::runtime_error(std::string("Display not created: ") + SDL_GetError());
+  }
+
+  // Start from a black screen
+  for(int i = 0; i < WINDOW_WIDTH * WINDOW_HEIGHT; i++) this->framebuffer[i] = 0xff000000;
+
   // Set init color
   SDL_SetRenderDrawColor(this->renderer, 0, 0, 0, 0);
 
@@ -31,49 +50,73 @@ Display_chip8::Display_chip8() {
   SDL_RenderPresent(this->renderer);
 }
 
-/** Memory::update
-    Given a memory of 256 bytes, update the screen with its content.
+/** Display_chip8::update
+    Given the video memory, update the rows of the screen
+    which changed and present the result.
+    Nothing is done if no row changed.
 
-    @param mem Memory video memory storing the data to show
+    @param mem        VideoMemory* video memory storing the data to show
+    @param dirty_rows uint64_t mask with bit n set if row n changed
+    @param hires      bool whether the screen is in high resolution
 */
-void Display_chip8::update(Memory* mem){
+void Display_chip8::update(VideoMemory* mem, uint64_t dirty_rows, bool hires){
 
-  // Check that the size of the memory is the expected one
-  if(mem->get_size() != WINDOW_WIDTH * WINDOW_HEIGHT / 8){
-    throw std::invalid_argument("Memory size is not right for dispaly");
-  }
+  // Color of a pixel, indexed by the planes where it is set
+  static const uint32_t palette[1 << SCREEN_PLANES] = {
+    0xff000000, 0xffffffff, 0xffaaaaaa, 0xff555555
+  };
 
-  // Clear the screen
-  SDL_RenderClear(this->renderer);
+  // The size of the memory has to be the one of the screen
+  static_assert(VideoMemory::get_size() == WINDOW_WIDTH * WINDOW_HEIGHT * SCREEN_PLANES / 8,
+                "Memory size is not right for dispaly");
+
+  if(dirty_rows == 0) return;
 
-  // For each byte in the memory
-  for(int i = 0; i < mem->get_size(); i++){
+  // In low resolution each pixel covers 2x2 pixels of the texture
+  int scale  = hires ? 1 : 2;
+  int height = WINDOW_HEIGHT / scale;
+  int width  = WINDOW_WIDTH / scale;
 
-    // Read the byte
-    uint8_t data = mem->read(i);
+  // For each row which changed
+  for(int row = 0; row < height; row++){
 
-    // For each bit in the byte
-    for(int j = 0; j < 8; j++){
+    if(!(dirty_rows & (1ULL << row))) continue;
 
-      // Get the corresponding indexes in the screen matrix
-      int column = (i * 8 + j) % WINDOW_WIDTH;
-      int row    = (i * 8 + j) / WINDOW_WIDTH;
+    // Pixel n of the row is bit n % 64 of its word n / 64, in each plane
+    uint64_t data[SCREEN_PLANES][WINDOW_WIDTH / 64];
+    for(int plane = 0; plane < SCREEN_PLANES; plane++)
+      for(int word = 0; word < WINDOW_WIDTH / 64; word++)
+        data[plane][word] = mem->read64(plane * PLANE_BYTES + row * ROW_BYTES + word * 8);
 
-      // Pick the color to use, either black or white depending whether the bit is set
-      if(data & (1 << j)) SDL_SetRenderDrawColor(this->renderer, 255, 255, 255, 255);
-      else                SDL_SetRenderDrawColor(this->renderer,   0,   0,   0, 255);
+    uint32_t* pixels = &this->framebuffer[row * scale * WINDOW_WIDTH];
 
-      // Fill the whole square in the window corresponding to the pixel
-      for(int x = 0; x < SCALE_FACTOR; x++){
-        for(int y = 0; y < SCALE_FACTOR; y++){
-          SDL_RenderDrawPoint(this->renderer,
-                              column * SCALE_FACTOR + x,
-                              row * SCALE_FACTOR + y);
-        }
-      }
+    // Pick the color to use depending on the planes where the bit is set
+    for(int column = 0; column < width; column++){
+
+      uint8_t color = 0;
+      for(int plane = 0; plane < SCREEN_PLANES; plane++)
+        color |= ((data[plane][column / 64] >> (column % 64)) & 1) << plane;
+
+      for(int i = 0; i < scale; i++)
+        for(int j = 0; j < scale; j++)
+          pixels[i * WINDOW_WIDTH + column * scale + j] = palette[color];
     }
   }
 
+  // Upload the rows from the first to the last one which changed,
+  // and let the renderer scale the screen to the window
+  int first = __builtin_ctzll(dirty_rows);
+  int last  = std::min(63 - __builtin_clzll(dirty_rows), height - 1);
+
+  if(first <= last){
+    SDL_Rect rect = { 0, first * scale, WINDOW_WIDTH, (last - first + 1) * scale };
+    SDL_UpdateTexture(this->texture, &rect, &this->framebuffer[rect.y * WINDOW_WIDTH],
+                      WINDOW_WIDTH * sizeof(uint32_t));
+  }
+
+  SDL_RenderClear(this->renderer);
+  SDL_RenderCopy(this->renderer, this->texture, NULL, NULL);
+
   // Render modifications
   SDL_RenderPresent(this->renderer);
 }
@@ -83,6 +126,7 @@ void Display_chip8::update(Memory* mem){
 
 */
 Display_chip8::~Display_chip8(){
+  SDL_DestroyTexture(texture);
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
   SDL_Quit();
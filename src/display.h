@@ -6,18 +6,24 @@
 #include "memory.h"
 #include <stdexcept>
 
-#define WINDOW_WIDTH  64
-#define WINDOW_HEIGHT 32
-#define SCALE_FACTOR  8
+#define WINDOW_WIDTH  SCREEN_WIDTH
+#define WINDOW_HEIGHT SCREEN_HEIGHT
+#define SCALE_FACTOR  4
 
 class Display_chip8{
   SDL_Event event;
   SDL_Renderer *renderer;
   SDL_Window *window;
 
+  // 128x64 texture, scaled to the window by the renderer
+  SDL_Texture *texture;
+
+  // Content of the texture, one ARGB value per pixel
+  uint32_t framebuffer[WINDOW_WIDTH * WINDOW_HEIGHT];
+
 public:
         Display_chip8();
-  void  update(Memory*);
+  void  update(VideoMemory*, uint64_t, bool);
         ~Display_chip8();
 };
 
@@ -0,0 +1,193 @@
+#include "machine.h"
+#include "input_script.h"
+#include "profile.h"
+#include "rewind.h"
+#include <stdexcept>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <cstdio>
+
+/** write_frame
+    Write the content of a video memory as a PBM image, 64x32 or
+    128x64 depending on the resolution. A pixel is set if it is
+    set in any plane.
+
+    @param vmem      VideoMemory* video memory to write
+    @param hires     bool whether the screen is in high resolution
+    @param file_name string name of the image
+*/
+void write_frame(VideoMemory* vmem, bool hires, std::string file_name){
+
+  std::ofstream file(file_name);
+  if(!file){
+    throw std::invalid_argument("Frame file not opened correctly");
+  }
+
+  int width  = hires ? SCREEN_WIDTH  : SCREEN_WIDTH / 2;
+  int height = hires ? SCREEN_HEIGHT : SCREEN_HEIGHT / 2;
+
+  file << "P1\n" << width << " " << height << "\n";
+
+  // Pixel n of a row is bit n % 8 of its byte n / 8
+  for(int row = 0; row < height; row++){
+    for(int column = 0; column < width; column++){
+
+      uint8_t pixel = 0;
+      for(int plane = 0; plane < SCREEN_PLANES; plane++)
+        pixel |= vmem->read(plane * PLANE_BYTES + row * ROW_BYTES + column / 8) >> (column % 8);
+
+      file << (pixel & 1) << ((column == width - 1) ? "\n" : " ");
+    }
+  }
+}
+
+/** usage
+    Print how to use the program.
+
+*/
+void usage(){
+  std::cerr << "usage: chip8_headless path_to_rom [options]\n"
+               "  --cycles N       instructions to execute (default 1000000)\n"
+               "  --keys FILE      input script or recording with the key events\n"
+               "  --frames DIR     write a PBM image of the screen in DIR for every frame\n"
+               "  --frame-cycles N instructions in a frame (default 10000)\n"
+               "  --ips N          instructions per second of emulated time (default 700)\n"
+               "  --seed N         seed of the random number generator\n"
+               "  --quirks NAME    behavior of the instructions: legacy, vip, schip or modern\n"
+               "  --quirks-db FILE database of the profiles of the roms, used without --quirks\n"
+               "  --no-halt        keep running when the program jumps to itself\n"
+               "  --no-idle        execute the idle loops instead of skipping them\n"
+               "  --no-jit         interpret every instruction, when built with JIT=1\n"
+               "  --restore FILE   start from the state saved in a snapshot, speed included\n"
+               "  --back N         go back N instructions at the end, through the rewind history\n"
+               "  --save FILE      save a snapshot of the final state\n";
+}
+
+int main(int argc, char* argv[]){
+
+  if(argc < 2){
+    usage();
+    throw std::invalid_argument("Not enough arguments to run");
+  }
+
+  std::string rom = argv[1];
+  std::string keys;
+  std::string frames;
+  std::string restore;
+  std::string save;
+  std::string quirks;
+  std::string database;
+  uint64_t cycles = 1000000;
+  uint64_t frame_cycles = 10000;
+  uint64_t ips = 0;
+  uint64_t seed = 0;
+  uint64_t back = 0;
+  bool seeded = false;
+  bool stop_on_halt = true;
+  bool skip_idle = true;
+  bool use_jit = true;
+
+  for(int i = 2; i < argc; i++){
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if     (arg == "--cycles"       && has_value) cycles = std::stoull(argv[++i]);
+    else if(arg == "--keys"         && has_value) keys = argv[++i];
+    else if(arg == "--frames"       && has_value) frames = argv[++i];
+    else if(arg == "--frame-cycles" && has_value) frame_cycles = std::stoull(argv[++i]);
+    else if(arg == "--ips"          && has_value) ips = std::stoull(argv[++i]);
+    else if(arg == "--seed"         && has_value) seed = std::stoull(argv[++i]), seeded = true;
+    else if(arg == "--restore"      && has_value) restore = argv[++i];
+    else if(arg == "--save"         && has_value) save = argv[++i];
+    else if(arg == "--back"         && has_value) back = std::stoull(argv[++i]);
+    else if(arg == "--quirks"       && has_value) quirks = argv[++i];
+    else if(arg == "--quirks-db"    && has_value) database = argv[++i];
+    else if(arg == "--no-halt")                   stop_on_halt = false;
+    else if(arg == "--no-idle")                   skip_idle = false;
+    else if(arg == "--no-jit")                    use_jit = false;
+    else {
+      usage();
+      throw std::invalid_argument("Argument not valid: " + arg);
+    }
+  }
+
+  if(frame_cycles == 0){
+    throw std::invalid_argument("A frame needs at least one instruction");
+  }
+
+  Machine machine;
+  InputScript script;
+
+  machine.load(rom);
+
+  // The profile given wins over the one of the database
+  uint8_t profile = QUIRKS_LEGACY;
+  if(!quirks.empty())        profile = quirks_from_name(quirks);
+  else if(!database.empty()) quirks_from_database(rom, database, &profile);
+
+  machine.set_quirks(profile);
+
+  if(!keys.empty()){
+    script.init_from_file(keys);
+    machine.set_input(&script);
+  }
+
+  // The options win over the settings of a recording
+  if(!seeded && script.has_seed()) seed = script.get_seed(), seeded = true;
+  if(ips == 0) ips = script.get_ips() ? script.get_ips() : DEFAULT_IPS;
+
+  if(seeded) machine.set_seed(seed);
+  machine.set_ips(ips);
+  machine.get_cpu()->set_idle_detection(skip_idle);
+  machine.get_cpu()->set_jit(use_jit);
+
+  if(!restore.empty()){
+    Snapshot snapshot;
+    snapshot.load_file(restore);
+    machine.restore(snapshot);
+  }
+
+  // Run frame by frame, until the budget is over or the program stops.
+  // To go back at the end, the start of each frame is kept in the history
+  Rewind rewind;
+  uint64_t frame = 0;
+  bool halted = false;
+
+  while(machine.get_cycle() < cycles && !halted){
+
+    if(back) rewind.capture(&machine, 0);
+
+    uint64_t left = cycles - machine.get_cycle();
+    machine.run((left < frame_cycles) ? left : frame_cycles);
+
+    if(!frames.empty()){
+      char name[32];
+      snprintf(name, sizeof(name), "/frame_%06lu.pbm", (unsigned long) frame);
+      write_frame(machine.get_vmem(), machine.get_cpu()->is_hires(), frames + name);
+    }
+
+    frame++;
+    halted = stop_on_halt && machine.halted();
+  }
+
+  for(uint64_t i = 0; i < back; i++){
+    if(!rewind.back_instruction(&machine)){
+      throw std::invalid_argument("The history does not go back " + std::to_string(back) + " instructions");
+    }
+  }
+
+  std::cout << "cycles=" << machine.get_cycle()
+            << " frames=" << frame
+            << " halted=" << (halted ? 1 : 0) << std::endl;
+
+  machine.get_cpu()->regs_dump();
+
+  if(!save.empty()){
+    Snapshot snapshot;
+    machine.save(&snapshot);
+    snapshot.save_file(save);
+  }
+
+  CHIP8_PROFILE_DUMP("chip8_profile.folded");
+}
@@ -0,0 +1,205 @@
+#include "input_script.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdio>
+
+/** InputScript::InputScript
+    Constructor of the class.
+    The script starts with no events, i.e. no key is ever pressed.
+
+*/
+InputScript::InputScript(){
+  this->next = 0;
+  this->key = 0;
+  this->seeded = false;
+  this->seed = 0;
+  this->ips = 0;
+}
+
+/** InputScript::init_from_file
+    Read the events from a file.
+    The events have to be sorted by cycle.
+
+    @param file_name string name of the file to use
+*/
+void InputScript::init_from_file(std::string file_name){
+
+  std::ifstream file(file_name);
+  if(!file){
+    throw std::invalid_argument("Input script not opened correctly");
+  }
+
+  std::string line;
+  this->events.clear();
+  this->seeded = false;
+  this->ips = 0;
+
+  while(std::getline(file, line)){
+
+    // Skip comments and empty lines
+    size_t first = line.find_first_not_of(" \t\r");
+    if(first == std::string::npos || line[first] == '#') continue;
+
+    std::istringstream fields(line);
+    input_event event;
+    unsigned int key;
+
+    // Settings of a recording
+    if(line.compare(first, 4, "seed") == 0 || line.compare(first, 3, "ips") == 0){
+      std::string name;
+      uint64_t value;
+
+      if(!(fields >> name >> value) || (name != "seed" && name != "ips")){
+        throw std::invalid_argument("Input script line not valid: " + line);
+      }
+
+      if(name == "seed") this->set_seed(value);
+      else               this->set_ips(value);
+      continue;
+    }
+
+    if(!(fields >> std::dec >> event.cycle >> std::hex >> key) || key > 0xffff){
+      throw std::invalid_argument("Input script line not valid: " + line);
+    }
+
+    if(!this->events.empty() && event.cycle < this->events.back().cycle){
+      throw std::invalid_argument("Input script events are not sorted");
+    }
+
+    event.key = key;
+    this->events.push_back(event);
+  }
+
+  this->next = 0;
+  this->key = 0;
+}
+
+/** InputScript::save_file
+    Write the script to a file, in the format read by init_from_file.
+
+    @param file_name string name of the file to write
+*/
+void InputScript::save_file(std::string file_name){
+
+  std::ofstream file(file_name);
+  if(!file){
+    throw std::invalid_argument("Input script not opened correctly");
+  }
+
+  if(this->seeded) file << "seed " << this->seed << "\n";
+  if(this->ips)    file << "ips " << this->ips << "\n";
+
+  char line[32];
+  for(const input_event& event : this->events){
+    snprintf(line, sizeof(line), "%llu %04x\n", (unsigned long long) event.cycle, event.key);
+    file << line;
+  }
+
+  if(!file){
+    throw std::invalid_argument("Input script not written correctly");
+  }
+}
+
+/** InputScript::record
+    Record the key state at a given cycle. An event is added only
+    when the state changes. Events at or after the cycle are dropped
+    first, so that recording continues correctly after going back in time.
+
+    @param cycle uint64_t cycle from which the key state applies
+    @param key   uint16_t mask with the pressed keys
+*/
+void InputScript::record(uint64_t cycle, uint16_t key){
+
+  while(!this->events.empty() && this->events.back().cycle >= cycle) this->events.pop_back();
+
+  uint16_t previous = this->events.empty() ? 0 : this->events.back().key;
+  if(key != previous) this->events.push_back({ cycle, key });
+}
+
+/** InputScript::set_seed
+    Set the seed of the random number generator of the recorded run.
+
+    @param seed uint32_t seed used by the run
+*/
+void InputScript::set_seed(uint32_t seed){
+  this->seeded = true;
+  this->seed = seed;
+}
+
+/** InputScript::set_ips
+    Set the speed of the CPU in the recorded run.
+
+    @param ips uint64_t instructions per second
+*/
+void InputScript::set_ips(uint64_t ips){
+  this->ips = ips;
+}
+
+/** InputScript::has_seed
+    Check whether the script gives the seed of the random number generator.
+
+    @return bool whether there is a seed
+*/
+bool InputScript::has_seed(){
+  return this->seeded;
+}
+
+/** InputScript::get_seed
+    Return the seed of the random number generator of the recorded run
+
+    @return uint32_t seed of the run
+*/
+uint32_t InputScript::get_seed(){
+  return this->seed;
+}
+
+/** InputScript::get_ips
+    Return the speed of the CPU in the recorded run
+
+    @return uint64_t instructions per second, 0 if not given
+*/
+uint64_t InputScript::get_ips(){
+  return this->ips;
+}
+
+/** InputScript::rewind
+    Go back to the start of the script, so that
+    earlier cycles can be asked for again.
+
+*/
+void InputScript::rewind(){
+  this->next = 0;
+  this->key = 0;
+}
+
+/** InputScript::key_at
+    Get the key state at a given cycle.
+    The cycles asked for must not decrease between calls.
+
+    @param cycle uint64_t current cycle
+    @return uint16_t mask with the pressed keys
+*/
+uint16_t InputScript::key_at(uint64_t cycle){
+
+  while(this->next < this->events.size() && this->events[this->next].cycle <= cycle){
+    this->key = this->events[this->next].key;
+    this->next++;
+  }
+
+  return this->key;
+}
+
+/** InputScript::next_event
+    Get the cycle of the first event after a given cycle.
+
+    @param cycle uint64_t current cycle
+    @return uint64_t cycle of the next event, UINT64_MAX if there is none
+*/
+uint64_t InputScript::next_event(uint64_t cycle){
+
+  for(size_t i = this->next; i < this->events.size(); i++)
+    if(this->events[i].cycle > cycle) return this->events[i].cycle;
+
+  return UINT64_MAX;
+}
@@ -0,0 +1,57 @@
+#ifndef __INPUT_SCRIPT_H
+#define __INPUT_SCRIPT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Change of the key state at a given cycle
+struct input_event {
+  uint64_t cycle;
+  uint16_t key;
+};
+
+// Scripted key input, used in place of the keyboard.
+// The file has one event per line, made of the cycle from which
+// the event applies (decimal) and the mask of the pressed keys
+// (hexadecimal), with the same meaning as Keyboard::read_key.
+// Empty lines and lines starting with # are ignored.
+// A recording also holds the seed of the random number generator
+// and the speed of the CPU, so that the run can be replayed exactly:
+//
+//    # press 5 for 1000 cycles
+//    seed  1234
+//    ips   700
+//    5000  0020
+//    6000  0000
+//
+class InputScript {
+  std::vector<input_event> events;
+
+  // Seed and speed of the recorded run, ips is 0 if not given
+  bool     seeded;
+  uint32_t seed;
+  uint64_t ips;
+
+  // Index of the first event not applied yet
+  size_t next;
+
+  // Key state from the last applied event
+  uint16_t key;
+
+public:
+            InputScript();
+  void      init_from_file(std::string);
+  void      save_file(std::string);
+  void      rewind();
+  void      record(uint64_t, uint16_t);
+  void      set_seed(uint32_t);
+  void      set_ips(uint64_t);
+  bool      has_seed();
+  uint32_t  get_seed();
+  uint64_t  get_ips();
+  uint16_t  key_at(uint64_t);
+  uint64_t  next_event(uint64_t);
+};
+
+#endif // !__INPUT_SCRIPT_H
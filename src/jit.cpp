@@ -0,0 +1,280 @@
+#include "jit.h"
+#include "chip8.h"
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+/** chip8_jit::chip8_jit
+    Constructor of the class.
+    Reserves the executable arena; on hosts which are not x86-64,
+    or where such memory cannot be mapped, the JIT is not available
+    and every lookup fails.
+
+*/
+chip8_jit::chip8_jit(){
+
+  this->arena = nullptr;
+
+#if defined(__x86_64__)
+  void* ptr = mmap(nullptr, JIT_ARENA_SIZE,
+                   PROT_READ | PROT_WRITE | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if(ptr != MAP_FAILED) this->arena = (uint8_t*) ptr;
+#endif
+
+  this->reset();
+}
+
+/** chip8_jit::chip8_jit
+    Copy constructor. The copy gets its own arena,
+    and translates its blocks again once used.
+
+*/
+chip8_jit::chip8_jit(const chip8_jit&) : chip8_jit() {}
+
+/** chip8_jit::operator=
+    Assignment. The translator keeps its own blocks.
+
+*/
+chip8_jit& chip8_jit::operator=(const chip8_jit&){
+  return *this;
+}
+
+/** chip8_jit::~chip8_jit
+    Destroyer of the class.
+
+*/
+chip8_jit::~chip8_jit(){
+#if defined(__x86_64__)
+  if(this->arena) munmap(this->arena, JIT_ARENA_SIZE);
+#endif
+}
+
+/** chip8_jit::available
+    Check whether the host can run translated code.
+
+    @return bool whether blocks can be translated
+*/
+bool chip8_jit::available(){
+  return this->arena != nullptr;
+}
+
+/** chip8_jit::reset
+    Drop all the blocks and free the whole arena.
+    The slots stay allocated, with no block.
+
+*/
+void chip8_jit::reset(){
+  this->used = 0;
+  std::fill(this->slots.begin(), this->slots.end(), slot { nullptr, UNKNOWN, 0 });
+}
+
+/** chip8_jit::emit
+    Write the x86-64 code of an instruction. The code expects
+    the address of the registers in rdi and the address of I in rsi,
+    and uses only al and cl as scratch, so that it can be
+    placed after any other instruction of the block.
+    The order of the loads and stores follows the instr_* methods,
+    so that the result is the same when x or y is VF.
+
+    @param out uint8_t* where to write the code, nullptr to only get the size
+    @param d   const chip8_decoded* instruction to translate
+    @return size_t number of bytes of code, 0 if the instruction cannot be translated
+*/
+size_t chip8_jit::emit(uint8_t* out, const chip8_decoded* d){
+
+  uint8_t buf[32];
+  size_t n = 0;
+
+  #define B(byte) buf[n++] = (uint8_t) (byte)
+
+  // ModRM encodings of [rdi + disp8], with al or cl as register
+  #define AL_AT(r) B(0x47), B(r)
+  #define CL_AT(r) B(0x4f), B(r)
+
+  switch(d->op){
+
+    // mov byte [rdi + x], kk
+    case OP_6xkk_LD:   B(0xc6); AL_AT(d->x); B(d->kk); break;
+
+    // add byte [rdi + x], kk
+    case OP_7xkk_ADD:  B(0x80); AL_AT(d->x); B(d->kk); break;
+
+    // mov al, [rdi + y]; mov [rdi + x], al
+    case OP_8xy0_LD:   B(0x8a); AL_AT(d->y); B(0x88); AL_AT(d->x); break;
+
+    // mov al, [rdi + y]; or/and/xor [rdi + x], al
+    case OP_8xy1_OR:   B(0x8a); AL_AT(d->y); B(0x08); AL_AT(d->x); break;
+    case OP_8xy2_AND:  B(0x8a); AL_AT(d->y); B(0x20); AL_AT(d->x); break;
+    case OP_8xy3_XOR:  B(0x8a); AL_AT(d->y); B(0x30); AL_AT(d->x); break;
+
+    // mov al, [rdi + x]; add al, [rdi + y]; setc cl;
+    // mov [rdi + 15], cl; mov [rdi + x], al
+    case OP_8xy4_ADD:
+      B(0x8a); AL_AT(d->x); B(0x02); AL_AT(d->y);
+      B(0x0f); B(0x92); B(0xc1);
+      B(0x88); CL_AT(15); B(0x88); AL_AT(d->x);
+      break;
+
+    // mov al, [rdi + x]; cmp al, [rdi + y]; seta cl; mov [rdi + 15], cl;
+    // mov al, [rdi + x]; sub al, [rdi + y]; mov [rdi + x], al
+    case OP_8xy5_SUB:
+      B(0x8a); AL_AT(d->x); B(0x3a); AL_AT(d->y);
+      B(0x0f); B(0x97); B(0xc1); B(0x88); CL_AT(15);
+      B(0x8a); AL_AT(d->x); B(0x2a); AL_AT(d->y); B(0x88); AL_AT(d->x);
+      break;
+
+    // mov al, [rdi + x]; and al, 1; mov [rdi + 15], al; shr byte [rdi + x], 1
+    case OP_8xy6_SHR:
+      B(0x8a); AL_AT(d->x); B(0x24); B(0x01);
+      B(0x88); AL_AT(15); B(0xd0); B(0x6f); B(d->x);
+      break;
+
+    // mov al, [rdi + y]; cmp al, [rdi + x]; seta cl; mov [rdi + 15], cl;
+    // mov al, [rdi + y]; sub al, [rdi + x]; mov [rdi + x], al
+    case OP_8xy7_SUBN:
+      B(0x8a); AL_AT(d->y); B(0x3a); AL_AT(d->x);
+      B(0x0f); B(0x97); B(0xc1); B(0x88); CL_AT(15);
+      B(0x8a); AL_AT(d->y); B(0x2a); AL_AT(d->x); B(0x88); AL_AT(d->x);
+      break;
+
+    // mov al, [rdi + x]; shr al, 7; mov [rdi + 15], al; shl byte [rdi + x], 1
+    case OP_8xyE_SHL:
+      B(0x8a); AL_AT(d->x); B(0xc0); B(0xe8); B(0x07);
+      B(0x88); AL_AT(15); B(0xd0); B(0x67); B(d->x);
+      break;
+
+    // mov word [rsi], nnn
+    case OP_Annn_LD:
+      B(0x66); B(0xc7); B(0x06); B(d->nnn & 0xff); B(d->nnn >> 8);
+      break;
+
+    // movzx eax, byte [rdi + x]; add [rsi], ax
+    case OP_Fx1E_ADD:
+      B(0x0f); B(0xb6); AL_AT(d->x); B(0x66); B(0x01); B(0x06);
+      break;
+
+    // movzx eax, byte [rdi + x]; lea eax, [rax + rax * 4]; mov [rsi], ax
+    case OP_Fx29_LD:
+      B(0x0f); B(0xb6); AL_AT(d->x); B(0x8d); B(0x04); B(0x80);
+      B(0x66); B(0x89); B(0x06);
+      break;
+
+    default:
+      return 0;
+  }
+
+  #undef B
+  #undef AL_AT
+  #undef CL_AT
+
+  if(out) memcpy(out, buf, n);
+  return n;
+}
+
+/** chip8_jit::lookup
+    Get the block starting at a given address,
+    translating it the first time the address is reached.
+
+    @param addr         uint16_t address of the first instruction
+    @param cache        chip8_decode_cache* decoded instructions of the memory
+    @param decode_table const uint8_t* table from instructions to opcodes
+    @param length       uint8_t* set to the number of instructions in the block
+    @return chip8_block_fn code of the block, nullptr if there is none
+*/
+chip8_block_fn chip8_jit::lookup(uint16_t addr, chip8_decode_cache* cache,
+                                 const uint8_t* decode_table, uint8_t* length){
+
+  if(addr >= this->slots.size())
+    this->slots.resize((addr / JIT_SLOTS_STEP + 1) * JIT_SLOTS_STEP, slot { nullptr, UNKNOWN, 0 });
+
+  if(this->slots[addr].state == UNKNOWN){
+
+    // Count the instructions which can be translated, and the code they need
+    size_t size = 1;
+    uint8_t count = 0;
+    uint32_t a = addr;
+
+    while(count < JIT_MAX_BLOCK && a < DECODE_CACHE_SIZE - 1){
+      if(cache->at(a)->op == OP_UNCACHED) cache->fill(a, decode_table);
+
+      size_t s = this->emit(nullptr, cache->at(a));
+      if(s == 0) break;
+
+      size += s, count++, a += 2;
+    }
+
+    // A single instruction is cheaper to interpret
+    if(count < 2 || !this->available()){
+      this->slots[addr].state = NONE;
+    }
+    else {
+
+      // Start again from an empty arena when full
+      if(this->used + size > JIT_ARENA_SIZE) this->reset();
+
+      uint8_t* out = this->arena + this->used;
+      size_t n = 0;
+
+      for(int i = 0; i < count; i++) n += this->emit(out + n, cache->at(addr + 2 * i));
+
+      // ret
+      out[n++] = 0xc3;
+
+      this->slots[addr] = slot { (chip8_block_fn) out, BLOCK, count };
+      this->used += n;
+    }
+  }
+
+  *length = this->slots[addr].length;
+  return this->slots[addr].code;
+}
+
+/** chip8_jit::invalidate
+    Drop the blocks using the bytes of a range of addresses,
+    so that they are translated again from the new content.
+
+    @param addr uint16_t first address of the range
+    @param size uint32_t number of bytes in the range
+*/
+void chip8_jit::invalidate(uint16_t addr, uint32_t size){
+
+  // Blocks starting up to this many bytes before the range can overlap it
+  uint32_t first = (addr > 2 * JIT_MAX_BLOCK) ? addr - 2 * JIT_MAX_BLOCK : 0;
+  uint32_t last  = (addr + size > DATA_MEMORY_SIZE) ? DATA_MEMORY_SIZE : addr + size;
+
+  // The addresses past the slots allocated have no block
+  if(last > this->slots.size()) last = this->slots.size();
+
+  for(uint32_t i = first; i < last; i++){
+
+    // A non translated address was rejected on its instruction, or on the
+    // next one when it is alone, so its entry depends on four bytes
+    uint32_t end = (this->slots[i].state == BLOCK) ? i + 2 * this->slots[i].length : i + 4;
+
+    if(this->slots[i].state != UNKNOWN && end > addr) this->slots[i] = slot { nullptr, UNKNOWN, 0 };
+  }
+}
+
+/** chip8_jit::on_write
+    Called after each write in the data memory.
+
+    @param addr uint16_t first address written
+    @param size uint32_t number of bytes written
+*/
+void chip8_jit::on_write(uint16_t addr, uint32_t size){
+  this->invalidate(addr, size);
+}
+
+/** chip8_jit::on_detach
+    Called when the data memory is not used anymore.
+    Nothing to do, the translator keeps no pointer to it.
+
+    @param const void* memory detaching the translator, not used
+*/
+void chip8_jit::on_detach(const void*){
+}
@@ -0,0 +1,64 @@
+#ifndef __JIT_H
+#define __JIT_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include "memory.h"
+
+// Bytes of executable memory reserved for the translated blocks
+#define JIT_ARENA_SIZE  (256 * 1024)
+
+// Maximum number of instructions in a translated block
+#define JIT_MAX_BLOCK   64
+
+// The slots of the addresses grow by this many addresses
+#define JIT_SLOTS_STEP  1024
+
+// Native code of a block, working on the registers and on I
+typedef void (*chip8_block_fn)(uint8_t* regs, uint16_t* I);
+
+struct chip8_decoded;
+class chip8_decode_cache;
+
+// Translator of straight-line runs of instructions into x86-64 code.
+// A block contains only instructions which affect the general registers
+// and I; the first instruction which does anything else (jumps, calls,
+// skips, memory and timer accesses, draws, key waits) ends the block
+// and is left to the interpreter.
+class chip8_jit : public MemoryObserver {
+
+  // State of each address
+  enum : uint8_t { UNKNOWN = 0, NONE, BLOCK };
+
+  // State of an address, with its block and number of instructions
+  struct slot {
+    chip8_block_fn code;
+    uint8_t        state;
+    uint8_t        length;
+  };
+
+  // Executable memory holding the code
+  uint8_t* arena;
+  size_t   used;
+
+  // Slots from address 0, allocated up to the highest address looked
+  // up so far, by JIT_SLOTS_STEP addresses; the others are UNKNOWN
+  std::vector<slot> slots;
+
+  void   reset();
+  size_t emit(uint8_t*, const chip8_decoded*);
+
+public:
+                  chip8_jit();
+                  chip8_jit(const chip8_jit&);
+  chip8_jit&      operator=(const chip8_jit&);
+                  ~chip8_jit();
+  bool            available();
+  chip8_block_fn  lookup(uint16_t, chip8_decode_cache*, const uint8_t*, uint8_t*);
+  void            invalidate(uint16_t, uint32_t);
+  void            on_write(uint16_t, uint32_t) override;
+  void            on_detach(const void*) override;
+};
+
+#endif // !__JIT_H
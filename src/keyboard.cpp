@@ -1,59 +1,124 @@
 #include "keyboard.h"
+#include <stdexcept>
+#include <string>
 
-/** key_is_pressed
-    Check whether a key is pressed.
-    Uses the X11 protocol
+// Key of the emulator of each physical key, using the following matching
+//
+//  1 2 3 4 -> 1 2 3 c
+//  q w e r    4 5 6 d
+//  a s d f    7 8 9 e
+//  z x c v    a 0 b f
+//
+static const struct { SDL_Scancode scancode; uint8_t key; } keymap[16] = {
+  { SDL_SCANCODE_1, 0x01 }, { SDL_SCANCODE_2, 0x02 }, { SDL_SCANCODE_3, 0x03 }, { SDL_SCANCODE_4, 0x0c },
+  { SDL_SCANCODE_Q, 0x04 }, { SDL_SCANCODE_W, 0x05 }, { SDL_SCANCODE_E, 0x06 }, { SDL_SCANCODE_R, 0x0d },
+  { SDL_SCANCODE_A, 0x07 }, { SDL_SCANCODE_S, 0x08 }, { SDL_SCANCODE_D, 0x09 }, { SDL_SCANCODE_F, 0x0e },
+  { SDL_SCANCODE_Z, 0x0a }, { SDL_SCANCODE_X, 0x00 }, { SDL_SCANCODE_C, 0x0b }, { SDL_SCANCODE_V, 0x0f },
+};
+
+/** Keyboard::Keyboard
+    Constructor of the class.
+    Starts the SDL event queue, if not done yet.
 
-    @param ks KeySym identifier of a key
-    @return bool whether the key is pressed or not
 */
-bool key_is_pressed(KeySym ks) {
-    Display *dpy = XOpenDisplay(":0");
-    char keys_return[32];
-    XQueryKeymap(dpy, keys_return);
-    KeyCode kc2 = XKeysymToKeycode(dpy, ks);
-    bool isPressed = !!(keys_return[kc2 >> 3] & (1 << (kc2 & 7)));
-    XCloseDisplay(dpy);
-    return isPressed;
+Keyboard::Keyboard(){
+
+  if(SDL_InitSubSystem(SDL_INIT_EVENTS) != 0){
+    throw std::runtime_error(std::string("Keyboard not created: ") + SDL_GetError());
+  }
+
+  this->keys = 0;
+  this->quit = false;
+  this->rewind = false;
+  this->fine = false;
+  this->fast = false;
 }
 
-/** Keyboard::read_key
-    Return which key is pressed using the following matching
+/** Keyboard::poll
+    Drain the SDL event queue, updating the state of the keys.
+    Closing the window or pressing p terminates the emulator,
+    backspace is held to go back in time, by instructions with shift,
+    and tab to run faster.
+
+*/
+void Keyboard::poll(){
+
+  SDL_Event event;
+
+  while(SDL_PollEvent(&event)){
+
+    if(event.type == SDL_QUIT){
+      this->quit = true;
+      continue;
+    }
+
+    if(event.type != SDL_KEYDOWN && event.type != SDL_KEYUP) continue;
+
+    SDL_Scancode scancode = event.key.keysym.scancode;
+
+    if(scancode == SDL_SCANCODE_P){
+      this->quit = true;
+      continue;
+    }
+
+    if(scancode == SDL_SCANCODE_BACKSPACE){
+      this->rewind = (event.type == SDL_KEYDOWN);
+      this->fine = (event.type == SDL_KEYDOWN) && (event.key.keysym.mod & KMOD_SHIFT);
+      continue;
+    }
+
+    if(scancode == SDL_SCANCODE_TAB){
+      this->fast = (event.type == SDL_KEYDOWN);
+      continue;
+    }
 
-    1 2 3 4 -> 1 2 3 a
-    q w e r    4 5 6 b
-    a s d f    7 8 9 c
-    z x c v    d 0 e f
+    // Set bit nth of keys if nth key is pressed
+    // (in this way more than one key can be pressed at a time)
+    for(int i = 0; i < 16; i++){
+      if(keymap[i].scancode != scancode) continue;
+
+      if(event.type == SDL_KEYDOWN) this->keys |= (1 << keymap[i].key);
+      else                          this->keys &= ~(1 << keymap[i].key);
+    }
+  }
+}
+
+/** Keyboard::read_key
+    Return which keys were pressed at the last call to poll.
 
     If the key x is pressed, then the xth bit of the result is set.
-    If the key p is pressed, the result is 0xffff
+    If the emulator has to terminate, the result is 0xffff
 
     @return uint16_t mask with the pressed keys
 */
 uint16_t Keyboard::read_key(){
+  return this->quit ? 0xffff : this->keys.load();
+}
+
+/** Keyboard::rewinding
+    Check whether the rewind key was held at the last call to poll.
+
+    @return bool whether to go back in time
+*/
+bool Keyboard::rewinding(){
+  return this->rewind;
+}
 
-  // Set bit nth of res if nth key is pressed
-  // (in this way more than one key can be pressed at a time)
-  uint16_t res = 0;
-
-  if(key_is_pressed(XK_1)) res |= (1 << 0x01); //1
-  if(key_is_pressed(XK_2)) res |= (1 << 0x02); //2
-  if(key_is_pressed(XK_3)) res |= (1 << 0x03); //3
-  if(key_is_pressed(XK_4)) res |= (1 << 0x0c); //c
-  if(key_is_pressed(XK_Q)) res |= (1 << 0x04); //4
-  if(key_is_pressed(XK_W)) res |= (1 << 0x05); //5
-  if(key_is_pressed(XK_E)) res |= (1 << 0x06); //6
-  if(key_is_pressed(XK_R)) res |= (1 << 0x0d); //d
-  if(key_is_pressed(XK_A)) res |= (1 << 0x07); //7
-  if(key_is_pressed(XK_S)) res |= (1 << 0x08); //8
-  if(key_is_pressed(XK_D)) res |= (1 << 0x09); //9
-  if(key_is_pressed(XK_F)) res |= (1 << 0x0e); //e
-  if(key_is_pressed(XK_Z)) res |= (1 << 0x0a); //a
-  if(key_is_pressed(XK_X)) res |= (1 << 0x00); //0
-  if(key_is_pressed(XK_C)) res |= (1 << 0x0b); //b
-  if(key_is_pressed(XK_V)) res |= (1 << 0x0f); //f
-  if(key_is_pressed(XK_P)) res = 0xffff;
-
-  return res;
+/** Keyboard::stepping
+    Check whether the rewind key was pressed with shift, to go
+    back one instruction at a time instead of one frame.
 
+    @return bool whether to go back by instructions
+*/
+bool Keyboard::stepping(){
+  return this->fine;
+}
+
+/** Keyboard::turbo
+    Check whether the turbo key was held at the last call to poll.
+
+    @return bool whether to run faster than the speed of the CPU
+*/
+bool Keyboard::turbo(){
+  return this->fast;
 }
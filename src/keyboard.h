@@ -1,14 +1,37 @@
 #ifndef __KEYBOARD_H
 #define __KEYBOARD_H
 
-#include <X11/Xlib.h>
-#include <iostream>
-#include "X11/keysym.h"
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <atomic>
 
+// Keyboard of the emulator, fed by the SDL event queue.
+// The events are drained once by poll, and the state of the
+// keys is kept as the mask returned by read_key. The state is
+// atomic, so that the emulation thread can read it while the
+// thread which owns the window polls the events.
 class Keyboard{
 
+  // Mask with the pressed keys
+  std::atomic<uint16_t> keys;
+
+  // Whether the user asked to terminate
+  std::atomic<bool> quit;
+
+  // Whether the rewind key is held, and whether it was pressed with shift
+  std::atomic<bool> rewind;
+  std::atomic<bool> fine;
+
+  // Whether the turbo key is held
+  std::atomic<bool> fast;
+
 public:
+           Keyboard();
+  void     poll();
   uint16_t read_key();
+  bool     rewinding();
+  bool     stepping();
+  bool     turbo();
 };
 
 #endif // ! __KEYBOARD_H
@@ -0,0 +1,440 @@
+#include "lockstep.h"
+#include "machine.h"
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/** chip8_lockstep::chip8_lockstep
+    Constructor of the class.
+
+    @param lanes size_t number of machines to run
+*/
+chip8_lockstep::chip8_lockstep(size_t lanes) :
+  dmem(lanes), vmem(lanes) {
+
+  if(lanes == 0){
+    throw std::invalid_argument("At least one lane is needed");
+  }
+
+  this->lanes = lanes;
+  this->stride = (lanes + LOCKSTEP_WIDTH - 1) / LOCKSTEP_WIDTH * LOCKSTEP_WIDTH;
+
+  this->regs.assign(16 * this->stride, 0);
+  this->I.assign(this->stride, 0);
+  this->PC.assign(this->stride, 0);
+  this->SP.assign(this->stride, 0);
+  this->DT.assign(this->stride, 0);
+  this->ST.assign(this->stride, 0);
+  this->rng.assign(this->stride, 0);
+  this->stack.assign(STACK_SIZE * this->stride, 0);
+  this->hires.assign(this->stride, 0);
+  this->planes.assign(this->stride, 0);
+  this->flags.assign(16 * this->stride, 0);
+  this->pattern.assign(AUDIO_PATTERN_SIZE * this->stride, 0);
+  this->pitch.assign(this->stride, 0);
+  this->written.assign(DATA_MEMORY_SIZE, 0);
+
+  this->script = nullptr;
+  this->cycle = 0;
+  this->ticks = 0;
+  this->vector_steps = 0;
+  this->scalar_steps = 0;
+
+  this->scalar.init();
+
+  for(auto& mem : this->dmem) mem.set_observer(this);
+}
+
+/** chip8_lockstep::~chip8_lockstep
+    Destroyer of the class.
+
+*/
+chip8_lockstep::~chip8_lockstep(){
+  for(auto& mem : this->dmem) mem.set_observer(nullptr);
+}
+
+/** chip8_lockstep::load
+    Reset all the lanes and load the same rom in each of them.
+    Lane i uses seed + i for its random number generator.
+
+    @param file_name string name of the rom to load
+    @param seed      uint32_t seed of the first lane
+*/
+void chip8_lockstep::load(std::string file_name, uint32_t seed){
+
+  for(size_t i = 0; i < this->lanes; i++){
+
+    // Same initial state as chip8::init
+    this->scalar.init();
+    this->scalar.set_seed(seed + i);
+    this->store_lane(i, &this->scalar);
+
+    this->dmem[i] = DataMemory();
+    this->vmem[i] = VideoMemory();
+    this->dmem[i].init_sprites();
+    this->dmem[i].init_from_file(ROM_ADDRESS, file_name);
+  }
+
+  // Loading is the same for every lane
+  std::fill(this->written.begin(), this->written.end(), 0);
+
+  this->cycle = 0;
+  this->ticks = 0;
+  this->vector_steps = 0;
+  this->scalar_steps = 0;
+}
+
+/** chip8_lockstep::set_input
+    Set the source of the keys, the same for all the lanes.
+
+    @param script InputScript* script to use, nullptr for no keys
+*/
+void chip8_lockstep::set_input(InputScript* script){
+  this->script = script;
+}
+
+/** chip8_lockstep::run
+    Execute a given number of instructions on all the lanes.
+
+    @param cycles uint64_t number of instructions to execute
+*/
+void chip8_lockstep::run(uint64_t cycles){
+
+  for(uint64_t i = 0; i < cycles; i++){
+
+    // Same timing of the timers as Machine at the default speed
+    if(this->cycle == ((this->ticks + 1) * DEFAULT_IPS + TIMER_HZ - 1) / TIMER_HZ){
+      this->tick_timers();
+      this->ticks++;
+    }
+
+    uint16_t key = (this->script) ? this->script->key_at(this->cycle) : 0;
+
+    if(this->step_vector()) this->vector_steps++;
+    else {
+      this->step_scalar(key);
+      this->scalar_steps++;
+    }
+
+    this->cycle++;
+  }
+}
+
+/** chip8_lockstep::tick_timers
+    Decrement the delay and sound timers of all the lanes.
+
+*/
+void chip8_lockstep::tick_timers(){
+  for(size_t i = 0; i < this->lanes; i++){
+    if(this->DT[i] > 0) this->DT[i]--;
+    if(this->ST[i] > 0) this->ST[i]--;
+  }
+}
+
+/** chip8_lockstep::load_lane
+    Copy the state of a lane into a CPU.
+
+    @param lane size_t index of the lane
+    @param cpu  chip8* CPU to write
+*/
+void chip8_lockstep::load_lane(size_t lane, chip8* cpu){
+
+  for(int r = 0; r < 16; r++) cpu->regs[r] = this->regs[r * this->stride + lane];
+  for(int s = 0; s < STACK_SIZE; s++) cpu->stack[s] = this->stack[s * this->stride + lane];
+  for(int f = 0; f < 16; f++) cpu->flags[f] = this->flags[f * this->stride + lane];
+  for(int b = 0; b < AUDIO_PATTERN_SIZE; b++) cpu->pattern[b] = this->pattern[b * this->stride + lane];
+
+  cpu->I   = this->I[lane];
+  cpu->PC  = this->PC[lane];
+  cpu->SP  = this->SP[lane];
+  cpu->DT  = this->DT[lane];
+  cpu->ST  = this->ST[lane];
+  cpu->rng = this->rng[lane];
+  cpu->hires  = this->hires[lane];
+  cpu->planes = this->planes[lane];
+  cpu->pitch  = this->pitch[lane];
+}
+
+/** chip8_lockstep::store_lane
+    Copy the state of a CPU into a lane.
+
+    @param lane size_t index of the lane
+    @param cpu  chip8* CPU to read
+*/
+void chip8_lockstep::store_lane(size_t lane, chip8* cpu){
+
+  for(int r = 0; r < 16; r++) this->regs[r * this->stride + lane] = cpu->regs[r];
+  for(int s = 0; s < STACK_SIZE; s++) this->stack[s * this->stride + lane] = cpu->stack[s];
+  for(int f = 0; f < 16; f++) this->flags[f * this->stride + lane] = cpu->flags[f];
+  for(int b = 0; b < AUDIO_PATTERN_SIZE; b++) this->pattern[b * this->stride + lane] = cpu->pattern[b];
+
+  this->I[lane]   = cpu->I;
+  this->PC[lane]  = cpu->PC;
+  this->SP[lane]  = cpu->SP;
+  this->DT[lane]  = cpu->DT;
+  this->ST[lane]  = cpu->ST;
+  this->rng[lane] = cpu->rng;
+  this->hires[lane]  = cpu->hires;
+  this->planes[lane] = cpu->planes;
+  this->pitch[lane]  = cpu->pitch;
+}
+
+/** chip8_lockstep::step_scalar
+    Execute one instruction on each lane, one lane at a time.
+
+    @param key uint16_t mask with the pressed keys
+*/
+void chip8_lockstep::step_scalar(uint16_t key){
+
+  for(size_t i = 0; i < this->lanes; i++){
+    this->load_lane(i, &this->scalar);
+
+    uint16_t pc = this->scalar.PC;
+    uint16_t IR = (this->dmem[i].read(pc) << 8 | this->dmem[i].read(pc + 1));
+    this->scalar.execute(IR, &this->dmem[i], &this->vmem[i], key);
+
+    this->store_lane(i, &this->scalar);
+  }
+}
+
+/** chip8_lockstep::step_vector
+    Execute one instruction on all the lanes at once, if they are
+    at the same PC, the instruction there is the same in every lane
+    and it can be executed with vector operations.
+
+    @return bool whether the instruction was executed
+*/
+bool chip8_lockstep::step_vector(){
+
+#if defined(__x86_64__)
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if(!has_avx2) return false;
+
+  uint16_t pc = this->PC[0];
+
+  // Both the bytes of the instruction have to be in memory,
+  // and not written since the rom was loaded
+  if(pc >= DATA_MEMORY_SIZE - 1 || this->written[pc] || this->written[pc + 1]) return false;
+
+  for(size_t i = 1; i < this->lanes; i++)
+    if(this->PC[i] != pc) return false;
+
+  chip8_decoded d;
+  uint16_t IR = (this->dmem[0].read(pc) << 8 | this->dmem[0].read(pc + 1));
+
+  chip8::split(IR, this->scalar.decode_table, &d);
+
+  // A skip over the 4 bytes of F000 nnnn moves PC by 4, left to chip8::execute
+  if(d.op == OP_3xkk_SE || d.op == OP_4xkk_SNE || d.op == OP_5xy0_SE || d.op == OP_9xy0_SNE){
+    uint16_t next = pc + 2;
+    if(next >= DATA_MEMORY_SIZE - 1 || this->written[next] || this->written[next + 1] ||
+       (this->dmem[0].read(next) == 0xf0 && this->dmem[0].read(next + 1) == 0x00)) return false;
+  }
+
+  switch(d.op){
+    case OP_1nnn_JP:  case OP_3xkk_SE:  case OP_4xkk_SNE: case OP_5xy0_SE:
+    case OP_6xkk_LD:  case OP_7xkk_ADD: case OP_8xy0_LD:  case OP_8xy1_OR:
+    case OP_8xy2_AND: case OP_8xy3_XOR: case OP_8xy4_ADD: case OP_8xy5_SUB:
+    case OP_8xy6_SHR: case OP_8xy7_SUBN: case OP_8xyE_SHL: case OP_9xy0_SNE:
+    case OP_Annn_LD:  case OP_Fx1E_ADD:
+      this->execute_avx2(&d);
+      return true;
+
+    default:
+      return false;
+  }
+#else
+  return false;
+#endif
+}
+
+#if defined(__x86_64__)
+
+/** chip8_lockstep::execute_avx2
+    Execute an instruction on all the lanes with AVX2,
+    all the lanes being at the same PC. The loads and the stores
+    follow the order of the instr_* methods, so that the result
+    is the same when x or y is VF.
+
+    @param d const chip8_decoded* instruction to execute
+*/
+__attribute__((target("avx2")))
+void chip8_lockstep::execute_avx2(const chip8_decoded* d){
+
+  #define LOAD(p)     _mm256_loadu_si256((const __m256i*) (p))
+  #define STORE(p, v) _mm256_storeu_si256((__m256i*) (p), (v))
+
+  const __m256i one = _mm256_set1_epi8(1);
+  const __m256i two = _mm256_set1_epi16(2);
+  const __m256i all = _mm256_set1_epi8(-1);
+
+  uint16_t pc = this->PC[0] + 2;
+
+  for(size_t i = 0; i < this->stride; i += LOCKSTEP_WIDTH){
+
+    uint8_t*  rx = &this->regs[d->x * this->stride + i];
+    uint8_t*  ry = &this->regs[d->y * this->stride + i];
+    uint8_t*  vf = &this->regs[15 * this->stride + i];
+    uint16_t* I  = &this->I[i];
+    uint16_t* PC = &this->PC[i];
+    __m256i a, b, sum, skip;
+
+    // Increment program counter, the same in every lane
+    STORE(PC,      _mm256_set1_epi16(pc));
+    STORE(PC + 16, _mm256_set1_epi16(pc));
+
+    switch(d->op){
+
+      case OP_1nnn_JP:
+        STORE(PC,      _mm256_set1_epi16(d->nnn));
+        STORE(PC + 16, _mm256_set1_epi16(d->nnn));
+        continue;
+
+      case OP_6xkk_LD:  STORE(rx, _mm256_set1_epi8(d->kk)); continue;
+      case OP_7xkk_ADD: STORE(rx, _mm256_add_epi8(LOAD(rx), _mm256_set1_epi8(d->kk))); continue;
+      case OP_8xy0_LD:  STORE(rx, LOAD(ry)); continue;
+      case OP_8xy1_OR:  STORE(rx, _mm256_or_si256(LOAD(rx), LOAD(ry))); continue;
+      case OP_8xy2_AND: STORE(rx, _mm256_and_si256(LOAD(rx), LOAD(ry))); continue;
+      case OP_8xy3_XOR: STORE(rx, _mm256_xor_si256(LOAD(rx), LOAD(ry))); continue;
+
+      // Carry when the sum is smaller than Vx
+      case OP_8xy4_ADD:
+        a = LOAD(rx), b = LOAD(ry);
+        sum = _mm256_add_epi8(a, b);
+        STORE(vf, _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(sum, a), sum), one));
+        STORE(rx, sum);
+        continue;
+
+      // Vx > Vy when max(Vx, Vy) is not Vy
+      case OP_8xy5_SUB:
+        a = LOAD(rx), b = LOAD(ry);
+        STORE(vf, _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), b), one));
+        STORE(rx, _mm256_sub_epi8(LOAD(rx), LOAD(ry)));
+        continue;
+
+      case OP_8xy6_SHR:
+        STORE(vf, _mm256_and_si256(LOAD(rx), one));
+        STORE(rx, _mm256_and_si256(_mm256_srli_epi16(LOAD(rx), 1), _mm256_set1_epi8(0x7f)));
+        continue;
+
+      case OP_8xy7_SUBN:
+        a = LOAD(rx), b = LOAD(ry);
+        STORE(vf, _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a), one));
+        STORE(rx, _mm256_sub_epi8(LOAD(ry), LOAD(rx)));
+        continue;
+
+      case OP_8xyE_SHL:
+        STORE(vf, _mm256_and_si256(_mm256_srli_epi16(LOAD(rx), 7), one));
+        a = LOAD(rx);
+        STORE(rx, _mm256_add_epi8(a, a));
+        continue;
+
+      case OP_Annn_LD:
+        STORE(I,      _mm256_set1_epi16(d->nnn));
+        STORE(I + 16, _mm256_set1_epi16(d->nnn));
+        continue;
+
+      case OP_Fx1E_ADD:
+        a = LOAD(rx);
+        STORE(I,      _mm256_add_epi16(LOAD(I),      _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a))));
+        STORE(I + 16, _mm256_add_epi16(LOAD(I + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1))));
+        continue;
+
+      // Skips: the mask of the lanes to skip is widened to 16 bits
+      case OP_3xkk_SE:  skip = _mm256_cmpeq_epi8(LOAD(rx), _mm256_set1_epi8(d->kk)); break;
+      case OP_4xkk_SNE: skip = _mm256_xor_si256(_mm256_cmpeq_epi8(LOAD(rx), _mm256_set1_epi8(d->kk)), all); break;
+      case OP_5xy0_SE:  skip = _mm256_cmpeq_epi8(LOAD(rx), LOAD(ry)); break;
+      case OP_9xy0_SNE: skip = _mm256_xor_si256(_mm256_cmpeq_epi8(LOAD(rx), LOAD(ry)), all); break;
+
+      default:
+        continue;
+    }
+
+    STORE(PC,      _mm256_add_epi16(LOAD(PC),      _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_castsi256_si128(skip)), two)));
+    STORE(PC + 16, _mm256_add_epi16(LOAD(PC + 16), _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_extracti128_si256(skip, 1)), two)));
+  }
+
+  #undef LOAD
+  #undef STORE
+}
+
+#else
+
+void chip8_lockstep::execute_avx2(const chip8_decoded*){
+}
+
+#endif
+
+/** chip8_lockstep::hash
+    Compute the hash of the state of a lane, the same
+    as Machine::hash of a machine in the same state.
+
+    @param lane size_t index of the lane
+    @return uint64_t FNV-1a hash of the state
+*/
+uint64_t chip8_lockstep::hash(size_t lane){
+  this->load_lane(lane, &this->scalar);
+
+  uint64_t h = FNV_OFFSET;
+  h = this->scalar.hash(h);
+  h = this->dmem[lane].hash(h);
+  h = this->vmem[lane].hash(h);
+  return h;
+}
+
+/** chip8_lockstep::get_lanes
+    Return the number of lanes
+
+    @return size_t number of lanes
+*/
+size_t chip8_lockstep::get_lanes(){
+  return this->lanes;
+}
+
+/** chip8_lockstep::get_cycle
+    Return the number of instructions executed by each lane
+
+    @return uint64_t number of instructions
+*/
+uint64_t chip8_lockstep::get_cycle(){
+  return this->cycle;
+}
+
+/** chip8_lockstep::get_vector_steps
+    Return the number of steps executed on all the lanes at once
+
+    @return uint64_t number of steps
+*/
+uint64_t chip8_lockstep::get_vector_steps(){
+  return this->vector_steps;
+}
+
+/** chip8_lockstep::get_scalar_steps
+    Return the number of steps executed one lane at a time
+
+    @return uint64_t number of steps
+*/
+uint64_t chip8_lockstep::get_scalar_steps(){
+  return this->scalar_steps;
+}
+
+/** chip8_lockstep::on_write
+    Called after each write in the data memory of a lane.
+
+    @param addr uint16_t first address written
+    @param size uint32_t number of bytes written
+*/
+void chip8_lockstep::on_write(uint16_t addr, uint32_t size){
+  for(uint32_t i = addr; i < addr + size && i < DATA_MEMORY_SIZE; i++) this->written[i] = 1;
+}
+
+/** chip8_lockstep::on_detach
+    Called when the data memory of a lane is not observed anymore.
+    Nothing to do, the lockstep core keeps no pointer to it.
+
+    @param const void* memory detaching the lockstep core, not used
+*/
+void chip8_lockstep::on_detach(const void*){
+}
@@ -0,0 +1,91 @@
+#ifndef __LOCKSTEP_H
+#define __LOCKSTEP_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "memory.h"
+#include "input_script.h"
+
+// Lanes processed by each AVX2 operation on 8 bits registers
+#define LOCKSTEP_WIDTH 32
+
+// Many machines running the same rom, stepped together.
+// The CPU state is stored as structure of arrays, so that
+// when all the lanes are at the same PC, the instructions which
+// only work on registers, I and PC (6xkk, 7xkk, 8xy*, the skips,
+// Annn, 1nnn, Fx1E) are executed on all the lanes at once with AVX2.
+// When the PCs diverge, or for any other instruction, each lane
+// is executed on its own by chip8::execute, so that the semantics
+// are the ones of the instr_* methods. The vector operations have
+// the legacy behavior, so the lanes always follow the legacy profile.
+class chip8_lockstep : public MemoryObserver {
+
+  // Number of lanes, and lanes allocated for each value
+  size_t lanes;
+  size_t stride;
+
+  // Register r of lane i is at regs[r * stride + i]
+  std::vector<uint8_t>  regs;
+  std::vector<uint16_t> I;
+  std::vector<uint16_t> PC;
+  std::vector<uint8_t>  SP;
+  std::vector<uint8_t>  DT;
+  std::vector<uint8_t>  ST;
+  std::vector<uint32_t> rng;
+
+  // Entry s of the stack of lane i is at stack[s * stride + i]
+  std::vector<uint16_t> stack;
+
+  std::vector<uint8_t>  hires;
+  std::vector<uint8_t>  planes;
+
+  // Flag f of lane i is at flags[f * stride + i]
+  std::vector<uint8_t>  flags;
+
+  // Byte b of the audio pattern of lane i is at pattern[b * stride + i]
+  std::vector<uint8_t>  pattern;
+  std::vector<uint8_t>  pitch;
+
+  std::vector<DataMemory>  dmem;
+  std::vector<VideoMemory> vmem;
+
+  // Addresses of the data memory written by any lane since the rom
+  // was loaded: instructions there can be different in each lane
+  std::vector<uint8_t> written;
+
+  // Source of the keys, nullptr if no key is ever pressed
+  InputScript* script;
+
+  uint64_t cycle;
+  uint64_t ticks;
+  uint64_t vector_steps;
+  uint64_t scalar_steps;
+
+  // CPU used to execute one lane at a time
+  chip8 scalar;
+
+  void load_lane(size_t, chip8*);
+  void store_lane(size_t, chip8*);
+  bool step_vector();
+  void step_scalar(uint16_t);
+  void tick_timers();
+  void execute_avx2(const chip8_decoded*);
+
+public:
+            chip8_lockstep(size_t);
+            ~chip8_lockstep();
+  void      load(std::string, uint32_t);
+  void      set_input(InputScript*);
+  void      run(uint64_t);
+  uint64_t  hash(size_t);
+  size_t    get_lanes();
+  uint64_t  get_cycle();
+  uint64_t  get_vector_steps();
+  uint64_t  get_scalar_steps();
+  void      on_write(uint16_t, uint32_t) override;
+  void      on_detach(const void*) override;
+};
+
+#endif // !__LOCKSTEP_H
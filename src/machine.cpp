@@ -0,0 +1,292 @@
+#include "machine.h"
+#include <stdexcept>
+
+/** Machine::Machine
+    Constructor of the class.
+
+*/
+Machine::Machine(){
+  this->script = nullptr;
+  this->key = 0;
+  this->cycle = 0;
+  this->ips = DEFAULT_IPS;
+  this->ticks = 0;
+  this->quirks = QUIRKS_LEGACY;
+}
+
+/** Machine::load
+    Reset the machine and load a rom.
+
+    @param file_name string name of the rom to load
+*/
+void Machine::load(std::string file_name){
+  this->cpu.init();
+  this->cpu.set_quirks(this->quirks);
+  this->dmem.init_sprites();
+  this->dmem.init_from_file(ROM_ADDRESS, file_name);
+  this->cycle = 0;
+  this->ticks = 0;
+}
+
+/** Machine::set_input
+    Set the source of the keys.
+
+    @param script InputScript* script to use, nullptr for the keys set by set_key
+*/
+void Machine::set_input(InputScript* script){
+  this->script = script;
+}
+
+/** Machine::set_key
+    Set the pressed keys, used when there is no input script.
+
+    @param key uint16_t mask with the pressed keys
+*/
+void Machine::set_key(uint16_t key){
+  this->key = key;
+}
+
+/** Machine::set_seed
+    Seed the random number generator of the CPU,
+    so that the run can be reproduced.
+
+    @param seed uint32_t seed to use
+*/
+void Machine::set_seed(uint32_t seed){
+  this->cpu.set_seed(seed);
+}
+
+/** Machine::set_quirks
+    Set the quirks profile of the CPU, for this rom and the next ones.
+
+    @param quirks uint8_t chip8_quirks of the profile
+*/
+void Machine::set_quirks(uint8_t quirks){
+  this->cpu.set_quirks(quirks);
+  this->quirks = quirks;
+}
+
+/** Machine::set_ips
+    Set the speed of the CPU, i.e. the number of instructions
+    executed in one second of emulated time.
+
+    @param ips uint64_t instructions per second
+*/
+void Machine::set_ips(uint64_t ips){
+  if(ips == 0){
+    throw std::invalid_argument("Instructions per second cannot be 0");
+  }
+
+  // Count as done the ticks before the current cycle
+  this->ips = ips;
+  this->ticks = (this->cycle > 0) ? (this->cycle - 1) * TIMER_HZ / ips : 0;
+}
+
+/** Machine::tick_cycle
+    Get the cycle at which a tick of the timers happens.
+
+    @param tick uint64_t number of the tick, starting from 1
+    @return uint64_t cycle of the tick
+*/
+uint64_t Machine::tick_cycle(uint64_t tick){
+  return (tick * this->ips + TIMER_HZ - 1) / TIMER_HZ;
+}
+
+/** Machine::run
+    Execute a given number of instructions.
+    The instructions are run in slices with the same key state,
+    split at the events of the input script and at the ticks
+    of the timers, which happen before the instruction of their cycle.
+    When the CPU ends a slice waiting for a key, or in a jump to
+    itself, the instructions up to the next change of the keys are
+    skipped, with the ticks of the timers in between.
+
+    @param cycles uint64_t number of instructions to execute
+    @return uint64_t number of instructions executed
+*/
+uint64_t Machine::run(uint64_t cycles){
+
+  uint64_t end = this->cycle + cycles;
+
+  while(this->cycle < end){
+
+    uint64_t next_tick = this->tick_cycle(this->ticks + 1);
+
+    if(this->cycle == next_tick){
+      this->cpu.tick_timers();
+      this->ticks++;
+      continue;
+    }
+
+    // First cycle at which the keys can change
+    uint64_t wake = end;
+    uint16_t key = this->key;
+
+    if(this->script){
+      key = this->script->key_at(this->cycle);
+      uint64_t next = this->script->next_event(this->cycle);
+      if(next < wake) wake = next;
+    }
+
+    uint64_t slice = wake - this->cycle;
+    if(next_tick - this->cycle < slice) slice = next_tick - this->cycle;
+    if(slice > UINT32_MAX) slice = UINT32_MAX;
+
+    this->cpu.run(&this->dmem, &this->vmem, key, slice);
+    this->cycle += slice;
+
+    // The CPU waits for the keys: the ticks in between only
+    // change the timers, go straight to the next change of the keys
+    if(this->cpu.get_idle() == IDLE_KEY){
+      while(this->tick_cycle(this->ticks + 1) < wake){
+        this->cpu.tick_timers();
+        this->ticks++;
+      }
+
+      this->cycle = wake;
+    }
+  }
+
+  return cycles;
+}
+
+/** Machine::halted
+    Check whether the program stopped, i.e. the
+    instruction at PC is a jump to itself, or 00FD.
+
+    @return bool whether the program is halted
+*/
+bool Machine::halted(){
+
+  uint16_t PC = this->cpu.get_PC();
+  if(PC >= this->dmem.get_size() - 1) return false;
+
+  uint16_t IR = (this->dmem.read(PC) << 8 | this->dmem.read(PC + 1));
+  return (PC < 0x1000 && IR == (0x1000 | PC)) || IR == 0x00fd;
+}
+
+/** Machine::get_cycle
+    Return the number of instructions executed since the rom was loaded
+
+    @return uint64_t number of instructions
+*/
+uint64_t Machine::get_cycle(){
+  return this->cycle;
+}
+
+/** Machine::hash
+    Compute a hash of the whole state of the machine:
+    registers, stack, timers, data and video memory.
+
+    @return uint64_t FNV-1a hash of the state
+*/
+uint64_t Machine::hash(){
+  uint64_t h = FNV_OFFSET;
+  h = this->cpu.hash(h);
+  h = this->dmem.hash(h);
+  h = this->vmem.hash(h);
+  return h;
+}
+
+/** Machine::save
+    Take a snapshot of the whole state of the machine:
+    cycle, timers ticks and speed, then the CPU, the data
+    memory and the video memory.
+
+    @param snapshot Snapshot* where to save the state
+*/
+void Machine::save(Snapshot* snapshot){
+
+  snapshot->resize(MACHINE_STATE_SIZE);
+  uint8_t* out = snapshot->data();
+
+  out = Snapshot::put(out, this->cycle, 8);
+  out = Snapshot::put(out, this->ticks, 8);
+  out = Snapshot::put(out, this->ips, 8);
+
+  this->cpu.save_state(out);
+  out += CHIP8_STATE_SIZE;
+
+  this->dmem.save(out);
+  out += DATA_MEMORY_SIZE;
+
+  this->vmem.save(out);
+}
+
+/** Machine::restore
+    Go back to the state saved in a snapshot.
+    The input script, if any, is kept, and continues
+    from the cycle of the snapshot.
+
+    @param snapshot const Snapshot& state to restore
+*/
+void Machine::restore(const Snapshot& snapshot){
+
+  if(snapshot.size() != MACHINE_STATE_SIZE){
+    throw std::invalid_argument("Snapshot size not valid");
+  }
+
+  const uint8_t* in = snapshot.data();
+
+  in = Snapshot::get(in, &this->cycle, 8);
+  in = Snapshot::get(in, &this->ticks, 8);
+  in = Snapshot::get(in, &this->ips, 8);
+
+  if(this->ips == 0){
+    throw std::invalid_argument("Snapshot not valid");
+  }
+
+  this->cpu.load_state(in);
+  in += CHIP8_STATE_SIZE;
+
+  this->dmem.load(in);
+  in += DATA_MEMORY_SIZE;
+
+  this->vmem.load(in);
+
+  if(this->script) this->script->rewind();
+}
+
+/** Machine::snapshot_cycle
+    Get the cycle at which a snapshot was taken.
+
+    @param snapshot const Snapshot& snapshot of a machine
+    @return uint64_t number of instructions executed before the snapshot
+*/
+uint64_t Machine::snapshot_cycle(const Snapshot& snapshot){
+
+  if(snapshot.size() != MACHINE_STATE_SIZE){
+    throw std::invalid_argument("Snapshot size not valid");
+  }
+
+  uint64_t cycle;
+  Snapshot::get(snapshot.data(), &cycle, 8);
+  return cycle;
+}
+
+/** Machine::get_cpu
+    Return the CPU of the machine
+
+    @return chip8* the CPU
+*/
+chip8* Machine::get_cpu(){
+  return &this->cpu;
+}
+
+/** Machine::get_dmem
+    Return the data memory of the machine
+
+    @return DataMemory* the data memory
+*/
+DataMemory* Machine::get_dmem(){
+  return &this->dmem;
+}
+
+/** Machine::get_vmem
+    Return the video memory of the machine
+
+    @return VideoMemory* the video memory
+*/
+VideoMemory* Machine::get_vmem(){
+  return &this->vmem;
+}
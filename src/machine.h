@@ -0,0 +1,65 @@
+#ifndef __MACHINE_H
+#define __MACHINE_H
+
+#include <stdint.h>
+#include <string>
+#include "chip8.h"
+#include "memory.h"
+#include "input_script.h"
+#include "snapshot.h"
+
+// Address where the roms are loaded
+#define ROM_ADDRESS 0x200
+
+// Bytes of the state of a machine in a snapshot
+#define MACHINE_STATE_SIZE (3 * 8 + CHIP8_STATE_SIZE + DATA_MEMORY_SIZE + VIDEO_MEMORY_SIZE)
+
+// CPU with its data and video memories, running without any
+// display or keyboard. The keys come from an InputScript, if any,
+// otherwise from the key state set by the caller.
+// Time is measured in instructions: the timers tick 60 times
+// every ips instructions, so that a run only depends on the rom,
+// the keys, the seed and the speed, and not on the host.
+class Machine {
+  chip8 cpu;
+  DataMemory  dmem;
+  VideoMemory vmem;
+
+  // Source of the keys, nullptr to use the key state set by set_key
+  InputScript* script;
+  uint16_t     key;
+
+  // Number of instructions executed so far
+  uint64_t cycle;
+
+  // Quirks profile of the CPU, kept when a rom is loaded
+  uint8_t quirks;
+
+  // Speed of the CPU, and ticks of the timers done so far
+  uint64_t ips;
+  uint64_t ticks;
+
+  uint64_t  tick_cycle(uint64_t);
+
+public:
+            Machine();
+  void      load(std::string);
+  void      set_input(InputScript*);
+  void      set_key(uint16_t);
+  void      set_seed(uint32_t);
+  void      set_ips(uint64_t);
+  void      set_quirks(uint8_t);
+  uint64_t  run(uint64_t);
+  bool      halted();
+  uint64_t  get_cycle();
+  uint64_t  hash();
+  void      save(Snapshot*);
+  void      restore(const Snapshot&);
+
+  static uint64_t snapshot_cycle(const Snapshot&);
+  chip8*    get_cpu();
+  DataMemory*  get_dmem();
+  VideoMemory* get_vmem();
+};
+
+#endif // !__MACHINE_H
@@ -1,35 +1,286 @@
-#include "memory.h"
-#include "chip8.h"
+#include "machine.h"
+#include "rewind.h"
 #include "keyboard.h"
 #include "display.h"
-#include <unistd.h>
+#include "audio.h"
+#include "scheduler.h"
+#include "profile.h"
+#include "pipeline.h"
 #include <stdexcept>
+#include <iostream>
+#include <string>
+#include <ctime>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <memory>
+
+// Time between two checks of the render thread for a new frame and for
+// input, which bounds the latency added by the pipeline
+#define RENDER_PERIOD std::chrono::milliseconds(2)
+
+/** usage
+    Print how to use the program.
+
+*/
+void usage(){
+  std::cerr << "usage: chip8_emulator path_to_rom [options]\n"
+               "  --ips N     instructions per second (default 700)\n"
+               "  --uncapped  run as fast as possible\n"
+               "  --turbo N   speed while tab is held (default 4 times)\n"
+               "  --frameskip K  frames presented in turbo, one every K and the last (default N)\n"
+               "  --record F  record the keys and the seed in F, to replay the run\n"
+               "  --replay F  replay a recording instead of reading the keyboard\n"
+               "  --latency   print the latency from draw to screen on exit\n"
+               "  --mute      do not play the sound\n"
+               "  --audio-buffer N  samples in a buffer of the audio device (default 256)\n"
+               "  --quirks NAME  behavior of the instructions: legacy, vip, schip or modern\n"
+               "  --quirks-db F  database of the profiles of the roms, used without --quirks\n";
+}
 
 int main(int argc, char* argv[]){
 
-  if(argc != 2){
+  if(argc < 2){
+    usage();
     throw std::invalid_argument("Not enough arguments to run");
   }
 
-  chip8 cpu;
-  Memory dmem(4096);
-  Memory vmem(256);
-  Keyboard keyboard;
+  uint64_t ips = 0;
+  bool uncapped = false;
+  bool stats = false;
+  uint32_t turbo = 4;
+  uint32_t frameskip = 0;
+  std::string record;
+  std::string replay;
+  std::string quirks;
+  std::string database;
+  bool mute = false;
+  uint32_t audio_buffer = AUDIO_BUFFER;
+
+  for(int i = 2; i < argc; i++){
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if     (arg == "--ips" && has_value) ips = std::stoull(argv[++i]);
+    else if(arg == "--uncapped")         uncapped = true;
+    else if(arg == "--latency")          stats = true;
+    else if(arg == "--turbo" && has_value) turbo = std::stoul(argv[++i]);
+    else if(arg == "--frameskip" && has_value) frameskip = std::stoul(argv[++i]);
+    else if(arg == "--record" && has_value) record = argv[++i];
+    else if(arg == "--replay" && has_value) replay = argv[++i];
+    else if(arg == "--quirks" && has_value) quirks = argv[++i];
+    else if(arg == "--quirks-db" && has_value) database = argv[++i];
+    else if(arg == "--mute")             mute = true;
+    else if(arg == "--audio-buffer" && has_value) audio_buffer = std::stoul(argv[++i]);
+    else {
+      usage();
+      throw std::invalid_argument("Argument not valid: " + arg);
+    }
+  }
+
+  if(!record.empty() && !replay.empty()){
+    throw std::invalid_argument("Cannot record and replay at the same time");
+  }
+
+  if(turbo == 0){
+    throw std::invalid_argument("Turbo speed cannot be 0");
+  }
+
+  if(audio_buffer == 0 || audio_buffer > UINT16_MAX){
+    throw std::invalid_argument("Audio buffer has to be from 1 to 65535 samples");
+  }
+
+  // By default only the last frame of each slice is presented in turbo,
+  // the frames are counted within the slice so that it always is
+  if(frameskip == 0) frameskip = turbo;
+
+  Machine machine;
+  InputScript script;
+  uint32_t seed = time(0);
+
+  machine.load(argv[1]);
+
+  // The profile given wins over the one of the database
+  uint8_t profile = QUIRKS_LEGACY;
+  if(!quirks.empty())        profile = quirks_from_name(quirks);
+  else if(!database.empty()) quirks_from_database(argv[1], database, &profile);
+
+  machine.set_quirks(profile);
+
+  // A replay runs with the seed and, unless given, the speed of the recording
+  if(!replay.empty()){
+    script.init_from_file(replay);
+    machine.set_input(&script);
+
+    if(script.has_seed()) seed = script.get_seed();
+    if(ips == 0) ips = script.get_ips();
+  }
+
+  if(ips == 0) ips = DEFAULT_IPS;
+
+  machine.set_seed(seed);
+  machine.set_ips(ips);
+
+  if(!record.empty()){
+    script.set_seed(seed);
+    script.set_ips(ips);
+  }
+
   Display_chip8 display;
-  uint16_t key_pressed;
+  Keyboard keyboard;
+  TripleBuffer<Frame> frames;
+
+  // The sound of each frame goes to the audio callback, unless muted
+  std::unique_ptr<Audio_chip8> audio;
+  if(!mute) audio.reset(new Audio_chip8(audio_buffer));
+  LatencyStats latency;
+
+  // Cleared by the render thread to stop the emulation thread
+  std::atomic<bool> running(true);
+
+  // Error which stopped the emulation thread, if any
+  std::exception_ptr error;
 
-  cpu.init();
-  dmem.init_sprites();
-  dmem.init_from_file(0x200, argv[1]);
+  // The emulation thread runs the machine, paced by the scheduler, and
+  // publishes the screen; it reads the keys through the atomic state of
+  // the keyboard, so that a slow presentation never delays the CPU
+  std::thread emulation([&](){
+    try {
+      Scheduler scheduler(ips);
+      Rewind rewind;
+      uint16_t last_key = 0;
 
-  // Press p to terminate
-  while(true){
-    key_pressed = keyboard.read_key();
-    if(key_pressed == 0xffff) break;
+      // Frames of emulated time run so far, and published so far
+      uint64_t ran = 0;
+      uint64_t published = 0;
 
-    cpu.step(&dmem, &vmem, key_pressed);
-    display.update(&vmem);
-    usleep(500);
+      // Whether the screen changed since the last published frame, and when
+      bool pending = false;
+      std::chrono::steady_clock::time_point drawn;
+
+      scheduler.set_uncapped(uncapped);
+
+      while(running.load(std::memory_order_relaxed)){
+
+        uint16_t key_pressed = keyboard.read_key();
+
+        // The user asked to terminate: 0xffff is not a state of the keys,
+        // and the render thread stops as soon as it sees it too
+        if(key_pressed == 0xffff) break;
+        bool due = scheduler.frame_due();
+
+        // While tab is held, each slice of host time runs several frames of
+        // emulated time, and only every skip-th one of the slice and its last
+        // one are presented. The timers still tick once per emulated frame,
+        // so the rom only sees a faster player
+        uint32_t count = keyboard.turbo() ? turbo : 1;
+        uint32_t skip  = keyboard.turbo() ? frameskip : 1;
+
+        for(uint32_t i = 0; i < count; i++){
+
+          bool present = due && ((i + 1) % skip == 0 || i + 1 == count);
+
+          // While backspace is held, go back one frame per slice,
+          // or one instruction with shift
+          if(keyboard.rewinding()){
+            if(keyboard.stepping()) rewind.back_instruction(&machine);
+            else                    rewind.back_frame(&machine);
+
+            // Capture the frame again when running forward
+            last_key = 0xffff;
+          }
+          else {
+
+            // The history gets a frame for each presented frame, and each time
+            // the keys change, since all the instructions of a frame use the same keys
+            if(present || key_pressed != last_key) rewind.capture(&machine, key_pressed);
+            last_key = key_pressed;
+
+            if(!record.empty()) script.record(machine.get_cycle(), key_pressed);
+
+            // A frame of 1/60 s, the timers tick in it
+            machine.set_key(key_pressed);
+            machine.run(scheduler.slice_cycles());
+          }
+
+          if(audio) audio->push(++ran, machine.get_cpu());
+
+          if(machine.get_cpu()->take_dirty_rows() && !pending){
+            pending = true;
+            drawn = std::chrono::steady_clock::now();
+          }
+
+          if(present && pending){
+            Frame* frame = frames.write_buffer();
+            frame->vmem = *machine.get_vmem();
+            frame->hires = machine.get_cpu()->is_hires();
+            frame->sequence = ++published;
+            frame->drawn = drawn;
+            frames.publish();
+
+            pending = false;
+          }
+        }
+
+        // An idle CPU only needs to run again at the next tick of the timers
+        scheduler.wait(machine.get_cpu()->get_idle() != IDLE_NONE);
+      }
+    }
+    catch(...){
+      error = std::current_exception();
+      running = false;
+    }
+
+    CHIP8_PROFILE_DUMP("chip8_profile.folded");
+  });
+
+  // The render thread, which owns the window, reads the keyboard and presents
+  // the last frame published, checking for both every RENDER_PERIOD. Press p
+  // or close the window to terminate
+  VideoMemory shown;
+  bool shown_hires = false;
+  uint64_t last = 0;
+
+  while(running.load(std::memory_order_relaxed)){
+    {
+      CHIP8_PROFILE_SCOPE(PROFILE_INPUT);
+      keyboard.poll();
+    }
+
+    if(keyboard.read_key() == 0xffff) break;
+
+    if(frames.consume()){
+      CHIP8_PROFILE_SCOPE(PROFILE_DISPLAY);
+      Frame* frame = frames.read_buffer();
+
+      // Frames in between may have been replaced, so the rows to update
+      // are the ones different from the screen shown, in any plane
+      uint64_t dirty_rows = 0;
+      for(int addr = 0; addr < VIDEO_MEMORY_SIZE; addr += 8)
+        if(frame->vmem.read64(addr) != shown.read64(addr)) dirty_rows |= 1ULL << (addr % PLANE_BYTES / ROW_BYTES);
+
+      // The whole screen changes with the resolution
+      if(frame->hires != shown_hires) dirty_rows = ~0ULL;
+
+      display.update(&frame->vmem, dirty_rows, frame->hires);
+      shown = frame->vmem;
+      shown_hires = frame->hires;
+
+      latency.add(std::chrono::steady_clock::now() - frame->drawn, frame->sequence - last - 1);
+      last = frame->sequence;
+    }
+
+    std::this_thread::sleep_for(RENDER_PERIOD);
   }
 
+  running = false;
+  emulation.join();
+
+  if(error) std::rethrow_exception(error);
+
+  if(!record.empty()) script.save_file(record);
+
+  if(stats) latency.report();
+
+  CHIP8_PROFILE_REPORT();
 }
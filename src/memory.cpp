@@ -1,40 +1,65 @@
 #include "memory.h"
 
-/** Memory::read
-    Read by from memory at a given address
+/** Memory::Memory
+    Memory constructor, with all the bytes set to 0
 
-    @param addr uint16_t address to read
-    @return uint8_t read byte
 */
-uint8_t Memory::read(uint16_t addr){
-  if(addr >= 4096)
-    throw std::invalid_argument( "Address cannot be >= 4096" );
+template<uint32_t N>
+Memory<N>::Memory(){
+  this->memory.fill(0);
+  this->observer = nullptr;
+}
+
+/** Memory::Memory
+    Copy constructor. The content is copied, while
+    the observer stays attached to the original memory only.
 
-  return this->memory[addr];
+    @param other Memory memory to copy
+*/
+template<uint32_t N>
+Memory<N>::Memory(const Memory& other){
+  this->memory = other.memory;
+  this->observer = nullptr;
 }
 
-/** Memory::write
-    Write a byte in memory at a given address
+/** Memory::operator=
+    Copy the content of another memory.
+    The observer of this memory is notified of the change.
 
-    @param addr uint16_t address to use
-    @param data uint8_t  byte to write
+    @param other Memory memory to copy
+    @return Memory& this memory
 */
-void Memory::write(uint16_t addr, uint8_t data){
-  if(addr >= 4096)
-    throw std::invalid_argument( "Address cannot be >= 4096" );
+template<uint32_t N>
+Memory<N>& Memory<N>::operator=(const Memory& other){
+  this->memory = other.memory;
 
-  this->memory[addr] = data;
+  if(this->observer) this->observer->on_write(0, N);
+
+  return *this;
 }
 
-/** Memory::Memory
-    Memory constructor
+/** Memory::~Memory
+    Destroyer of the class.
+    The observer, if any, is told to stop using this memory.
 
-    @param size uint8_t  number of bytes in the memory
 */
-Memory::Memory(uint32_t size){
-  this->size = size;
-  this->memory.resize(size);
-  for(int i = 0; i < size; i++) this->memory[i] = 0;
+template<uint32_t N>
+Memory<N>::~Memory(){
+  if(this->observer) this->observer->on_detach(this);
+}
+
+/** Memory::set_observer
+    Set the object to notify after each write in the memory.
+    The previous observer, if any, is detached.
+
+    @param observer MemoryObserver* object to notify, nullptr to remove it
+*/
+template<uint32_t N>
+void Memory<N>::set_observer(MemoryObserver* observer){
+  if(this->observer && this->observer != observer)
+    this->observer->on_detach(this);
+
+  this->observer = observer;
 }
 
 /** Memory::write_instruction
@@ -44,7 +69,8 @@ Memory::Memory(uint32_t size){
     @param addr uint16_t address to use
     @param data uint16_t data to write
 */
-void Memory::write_instruction(uint16_t addr, uint16_t data){
+template<uint32_t N>
+void Memory<N>::write_instruction(uint16_t addr, uint16_t data){
 
   if(addr & 1) {
     throw std::invalid_argument("Instruction address has to be even");
@@ -53,18 +79,88 @@ void Memory::write_instruction(uint16_t addr, uint16_t data){
   uint8_t lsb = data & 0xff;
   uint8_t msb = (data & 0xff00) >> 8;
 
+  addr = wrap(addr);
+
   this->memory[addr] = msb;
   this->memory[addr + 1] = lsb;
+
+  if(this->observer) this->observer->on_write(addr, 2);
+}
+
+/** Memory::move
+    Copy a range of bytes to another address, as memmove does:
+    the two ranges can overlap. Neither range can wrap around
+    the end of the memory.
+
+    @param to   uint16_t first address to write
+    @param from uint16_t first address to read
+    @param size uint32_t number of bytes to copy
+*/
+template<uint32_t N>
+void Memory<N>::move(uint16_t to, uint16_t from, uint32_t size){
+
+  if((uint32_t) to + size > N || (uint32_t) from + size > N){
+    throw std::invalid_argument("Range out of the memory");
+  }
+
+  if(size == 0) return;
+
+  memmove(&this->memory[to], &this->memory[from], size);
+
+  if(this->observer) this->observer->on_write(to, size);
+}
+
+/** Memory::fill
+    Set all the bytes of a range to the same value.
+    The range cannot wrap around the end of the memory.
+
+    @param addr  uint16_t first address to write
+    @param size  uint32_t number of bytes to write
+    @param value uint8_t value to write
+*/
+template<uint32_t N>
+void Memory<N>::fill(uint16_t addr, uint32_t size, uint8_t value){
+
+  if((uint32_t) addr + size > N){
+    throw std::invalid_argument("Range out of the memory");
+  }
+
+  if(size == 0) return;
+
+  memset(&this->memory[addr], value, size);
+
+  if(this->observer) this->observer->on_write(addr, size);
 }
 
+// Sprites of the characters from 0 to F, 8x10 pixels each
+static const uint8_t big_font[16 * 10] = {
+  0xff, 0xff, 0xc3, 0xc3, 0xc3, 0xc3, 0xc3, 0xc3, 0xff, 0xff,
+  0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xff, 0xff,
+  0xff, 0xff, 0x03, 0x03, 0xff, 0xff, 0xc0, 0xc0, 0xff, 0xff,
+  0xff, 0xff, 0x03, 0x03, 0xff, 0xff, 0x03, 0x03, 0xff, 0xff,
+  0xc3, 0xc3, 0xc3, 0xc3, 0xff, 0xff, 0x03, 0x03, 0x03, 0x03,
+  0xff, 0xff, 0xc0, 0xc0, 0xff, 0xff, 0x03, 0x03, 0xff, 0xff,
+  0xff, 0xff, 0xc0, 0xc0, 0xff, 0xff, 0xc3, 0xc3, 0xff, 0xff,
+  0xff, 0xff, 0x03, 0x03, 0x06, 0x0c, 0x18, 0x18, 0x18, 0x18,
+  0xff, 0xff, 0xc3, 0xc3, 0xff, 0xff, 0xc3, 0xc3, 0xff, 0xff,
+  0xff, 0xff, 0xc3, 0xc3, 0xff, 0xff, 0x03, 0x03, 0xff, 0xff,
+  0x7e, 0xff, 0xc3, 0xc3, 0xc3, 0xff, 0xff, 0xc3, 0xc3, 0xc3,
+  0xfc, 0xfc, 0xc3, 0xc3, 0xfc, 0xfc, 0xc3, 0xc3, 0xfc, 0xfc,
+  0x3c, 0xff, 0xc3, 0xc0, 0xc0, 0xc0, 0xc0, 0xc3, 0xff, 0x3c,
+  0xfc, 0xfe, 0xc3, 0xc3, 0xc3, 0xc3, 0xc3, 0xc3, 0xfe, 0xfc,
+  0xff, 0xff, 0xc0, 0xc0, 0xff, 0xff, 0xc0, 0xc0, 0xff, 0xff,
+  0xff, 0xff, 0xc0, 0xc0, 0xff, 0xff, 0xc0, 0xc0, 0xc0, 0xc0,
+};
+
 /** Memory::init_sprites
     Initialize the first 80 bytes of a memory with the sprites of the
-    characters from 0 to F.
+    characters from 0 to F, followed by their 8x10 sprites.
 
 */
-void Memory::init_sprites(){
+template<uint32_t N>
+void Memory<N>::init_sprites(){
 
-  if(this->size < 0x4f){
+  if(N < BIG_FONT_ADDRESS + sizeof(big_font)){
     throw std::invalid_argument("Memory too small to write sprites into");
   }
 
@@ -179,15 +275,10 @@ void Memory::init_sprites(){
   this->memory[0x4d] = 0xf0;
   this->memory[0x4e] = 0x80;
   this->memory[0x4f] = 0x80;
-}
 
-/** Memory::get_size
-    Return the size of the memory
+  memcpy(&this->memory[BIG_FONT_ADDRESS], big_font, sizeof(big_font));
 
-    @return uint32_t Size of the memory
-*/
-uint32_t Memory::get_size(){
-  return this->size;
+  if(this->observer) this->observer->on_write(0x00, BIG_FONT_ADDRESS + sizeof(big_font));
 }
 
 /** Memory::init_from_file
@@ -196,7 +287,8 @@ uint32_t Memory::get_size(){
     @param  init_addr uint16_t first address to use
     @param  file_name string name of the file to use
 */
-void Memory::init_from_file(uint16_t init_addr, std::string file_name){
+template<uint32_t N>
+void Memory<N>::init_from_file(uint16_t init_addr, std::string file_name){
 
   // Stream for the input file
   std::ifstream file;
@@ -212,6 +304,10 @@ void Memory::init_from_file(uint16_t init_addr, std::string file_name){
   file.seekg(0, std::ios::end);
   size = file.tellg() ;
 
+  if(init_addr + size > N){
+    throw std::invalid_argument("File too big for the memory");
+  }
+
   // Put the file pointer at the beginning of it
 	file.seekg(0, std::ios::beg);
 
@@ -223,4 +319,59 @@ void Memory::init_from_file(uint16_t init_addr, std::string file_name){
 	for (size_t i = 0; i < size; i++ )
     this->memory[i + init_addr] = oData[i];
 
+  delete[] oData;
+
+  if(this->observer) this->observer->on_write(init_addr, size);
+
 }
+
+/** Memory::hash
+    Add the content of the memory to a FNV-1a hash.
+
+    @param h uint64_t hash so far
+    @return uint64_t updated hash
+*/
+template<uint32_t N>
+uint64_t Memory<N>::hash(uint64_t h){
+  for(uint32_t i = 0; i < N; i++){
+    h ^= this->memory[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+/** Memory::save
+    Copy the content of the memory.
+
+    @param out uint8_t* where to write the N bytes
+*/
+template<uint32_t N>
+void Memory<N>::save(uint8_t* out){
+  memcpy(out, this->memory.data(), N);
+}
+
+/** Memory::load
+    Set the content of the memory. The observer is notified
+    only of the range of bytes which changed, so that what
+    it built from the other bytes is kept.
+
+    @param in const uint8_t* the N bytes to copy
+*/
+template<uint32_t N>
+void Memory<N>::load(const uint8_t* in){
+
+  // Notify the smallest range covering the changed bytes
+  uint32_t first = 0, last = N;
+
+  while(first < N && this->memory[first] == in[first]) first++;
+  if(first == N) return;
+  while(this->memory[last - 1] == in[last - 1]) last--;
+
+  memcpy(&this->memory[first], in + first, last - first);
+
+  if(this->observer) this->observer->on_write(first, last - first);
+}
+
+// Memories used by the machine
+template class Memory<DATA_MEMORY_SIZE>;
+template class Memory<VIDEO_MEMORY_SIZE>;
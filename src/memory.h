@@ -3,24 +3,184 @@
 
 #include <cstdint>
 #include <stdexcept>
-#include <vector>
+#include <array>
 #include <cstring>
 #include <fstream>
 #include <cstddef>
 #include <iostream>
 
+// Parameters of the FNV-1a hash used to compare machine states
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+// Size of the data memory, the 64 KB address space of XO-CHIP
+#define DATA_MEMORY_SIZE  65536
+
+// Screen in high resolution; in low resolution only the top left
+// 64x32 pixels are used. XO-CHIP draws on two planes
+#define SCREEN_WIDTH  128
+#define SCREEN_HEIGHT 64
+#define SCREEN_PLANES 2
+
+// The video memory is made of rows of 64 bits words: pixel n of a row
+// is bit n % 64 of its word n / 64, and the planes follow each other
+#define ROW_BYTES   (SCREEN_WIDTH / 8)
+#define PLANE_BYTES (ROW_BYTES * SCREEN_HEIGHT)
+#define VIDEO_MEMORY_SIZE (PLANE_BYTES * SCREEN_PLANES)
+
+// Address of the 8x10 sprites of the characters, used in high resolution
+#define BIG_FONT_ADDRESS 0x50
+
+// Interface of the objects which need to know when a Memory changes
+class MemoryObserver {
+public:
+  virtual void on_write(uint16_t addr, uint32_t size) = 0;
+  virtual void on_detach(const void* mem) = 0;
+  virtual ~MemoryObserver() {}
+};
+
+// Memory of N bytes, N being a power of 2.
+// Addresses wrap around the size of the memory, as on the real
+// hardware, so that the accessors compile to a single masked load
+// or store. Building with CHIP8_CHECKED_MEMORY defined makes
+// any access out of the memory throw instead, to find such
+// accesses when debugging a rom. The accessors take 32 bits
+// addresses, so that e.g. I + x past the end of the 64 KB data
+// memory reaches the check instead of being narrowed to 16 bits.
+template<uint32_t N>
 class Memory {
-  uint32_t size;
-  std::vector<uint8_t> memory;
+  static_assert(N >= 8 && (N & (N - 1)) == 0, "Memory size has to be a power of 2");
+
+  std::array<uint8_t, N> memory;
+
+  // Notified after each write, if set
+  MemoryObserver* observer;
+
+  static uint32_t   wrap(uint32_t);
 
 public:
-            Memory(uint32_t);
-  uint8_t   read(uint16_t);
-  void      write(uint16_t, uint8_t);
-  void      write_instruction(uint16_t, uint16_t);
-  void      init_sprites();
-  uint32_t  get_size();
-  void      init_from_file(uint16_t, std::string);
+                    Memory();
+                    Memory(const Memory&);
+  Memory&           operator=(const Memory&);
+                    ~Memory();
+  void              set_observer(MemoryObserver*);
+  uint8_t           read(uint32_t);
+  void              write(uint32_t, uint8_t);
+  uint64_t          read64(uint32_t);
+  void              write64(uint32_t, uint64_t);
+  void              move(uint16_t, uint16_t, uint32_t);
+  void              fill(uint16_t, uint32_t, uint8_t);
+  void              write_instruction(uint16_t, uint16_t);
+  void              init_sprites();
+  static constexpr  uint32_t get_size() { return N; }
+  void              init_from_file(uint16_t, std::string);
+  uint64_t          hash(uint64_t);
+  void              save(uint8_t*);
+  void              load(const uint8_t*);
 };
 
+typedef Memory<DATA_MEMORY_SIZE>  DataMemory;
+typedef Memory<VIDEO_MEMORY_SIZE> VideoMemory;
+
+/** Memory::wrap
+    Map an address into the memory.
+
+    @param addr uint32_t address to map
+    @return uint32_t index of the byte in the memory
+*/
+template<uint32_t N>
+inline uint32_t Memory<N>::wrap(uint32_t addr){
+#ifdef CHIP8_CHECKED_MEMORY
+  if(addr >= N)
+    throw std::invalid_argument( "Address out of the memory" );
+
+  return addr;
+#else
+  return addr & (N - 1);
+#endif
+}
+
+/** Memory::read
+    Read by from memory at a given address
+
+    @param addr uint32_t address to read
+    @return uint8_t read byte
+*/
+template<uint32_t N>
+inline uint8_t Memory<N>::read(uint32_t addr){
+  return this->memory[wrap(addr)];
+}
+
+/** Memory::write
+    Write a byte in memory at a given address
+
+    @param addr uint32_t address to use
+    @param data uint8_t  byte to write
+*/
+template<uint32_t N>
+inline void Memory<N>::write(uint32_t addr, uint8_t data){
+  addr = wrap(addr);
+  this->memory[addr] = data;
+
+  if(this->observer) this->observer->on_write(addr, 1);
+}
+
+/** Memory::read64
+    Read 8 bytes from memory starting at a given address.
+    The byte at addr is the least significant one, so that
+    bit n of the result is bit n % 8 of byte addr + n / 8.
+
+    @param addr uint32_t address of the first byte
+    @return uint64_t read bytes
+*/
+template<uint32_t N>
+inline uint64_t Memory<N>::read64(uint32_t addr){
+
+  uint64_t data;
+
+  if(wrap(addr) + 8 <= N){
+    memcpy(&data, &this->memory[wrap(addr)], 8);
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    data = __builtin_bswap64(data);
+#endif
+  }
+  else {
+
+    // The bytes wrap around the end of the memory
+    data = 0;
+    for(int i = 7; i >= 0; i--) data = data << 8 | this->memory[wrap(addr + i)];
+  }
+
+  return data;
+}
+
+/** Memory::write64
+    Write 8 bytes in memory starting at a given address,
+    least significant byte first.
+
+    @param addr uint32_t address of the first byte
+    @param data uint64_t bytes to write
+*/
+template<uint32_t N>
+inline void Memory<N>::write64(uint32_t addr, uint64_t data){
+
+  if(wrap(addr) + 8 > N){
+
+    // The bytes wrap around the end of the memory
+    for(int i = 0; i < 8; i++) this->write(addr + i, data >> (8 * i));
+    return;
+  }
+
+  addr = wrap(addr);
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  data = __builtin_bswap64(data);
+#endif
+
+  memcpy(&this->memory[addr], &data, 8);
+
+  if(this->observer) this->observer->on_write(addr, 8);
+}
+
 #endif // !__MEMORY_H
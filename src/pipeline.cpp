@@ -0,0 +1,82 @@
+#include "pipeline.h"
+#include <cstdio>
+#include <iostream>
+
+/** LatencyStats::LatencyStats
+    Constructor of the class.
+
+*/
+LatencyStats::LatencyStats(){
+  this->count = 0;
+  this->replaced = 0;
+  this->total = 0;
+  this->min = UINT64_MAX;
+  this->max = 0;
+  for(int i = 0; i < LATENCY_BUCKETS; i++) this->buckets[i] = 0;
+}
+
+/** LatencyStats::add
+    Count the latency of a frame presented.
+
+    @param latency  duration from the draw to the presentation
+    @param replaced uint64_t frames published since the previous one, never presented
+*/
+void LatencyStats::add(std::chrono::steady_clock::duration latency, uint64_t replaced){
+
+  this->replaced += replaced;
+
+  uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+
+  int bucket = 0;
+  while(bucket < LATENCY_BUCKETS - 1 && (1ULL << bucket) <= us) bucket++;
+
+  this->buckets[bucket]++;
+  this->count++;
+  this->total += us;
+  if(us < this->min) this->min = us;
+  if(us > this->max) this->max = us;
+}
+
+/** LatencyStats::percentile
+    Get an upper bound of a percentile of the latencies,
+    the end of the bucket where it falls.
+
+    @param p double percentile, from 0 to 100
+    @return uint64_t latency in microseconds
+*/
+uint64_t LatencyStats::percentile(double p){
+
+  uint64_t rank = (uint64_t) (p / 100 * this->count);
+  uint64_t seen = 0;
+
+  for(int i = 0; i < LATENCY_BUCKETS; i++){
+    seen += this->buckets[i];
+    if(seen > rank) return (1ULL << i) < this->max ? (1ULL << i) : this->max;
+  }
+
+  return this->max;
+}
+
+/** LatencyStats::report
+    Print the number of frames presented and their latency.
+
+*/
+void LatencyStats::report(){
+
+  if(this->count == 0){
+    std::cerr << "no frames presented" << std::endl;
+    return;
+  }
+
+  char line[200];
+  snprintf(line, sizeof(line),
+           "%llu frames presented, %llu replaced, draw to screen latency: min %llu us, "
+           "mean %llu us, p50 < %llu us, p99 < %llu us, max %llu us",
+           (unsigned long long) this->count, (unsigned long long) this->replaced,
+           (unsigned long long) this->min,
+           (unsigned long long) (this->total / this->count),
+           (unsigned long long) this->percentile(50), (unsigned long long) this->percentile(99),
+           (unsigned long long) this->max);
+
+  std::cerr << line << std::endl;
+}
@@ -0,0 +1,193 @@
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include "memory.h"
+
+// Buckets of the latency histogram, bucket n counting the
+// latencies from 2^(n-1) to 2^n microseconds
+#define LATENCY_BUCKETS 24
+
+// Screen produced by the emulation thread for the render thread
+struct Frame {
+  VideoMemory vmem;
+
+  // Whether vmem is in high resolution
+  bool hires;
+
+  // Number of the frame, starting from 1
+  uint64_t sequence;
+
+  // Host time of the end of the slice in which the screen was first
+  // drawn since the previous frame, from which the latency is measured
+  std::chrono::steady_clock::time_point drawn;
+};
+
+// Three buffers shared by one producer and one consumer, with no lock.
+// The producer fills its back buffer and publishes it, swapping it with
+// the middle one; the consumer takes the middle buffer, if a newer one
+// was published, swapping it with its front buffer. Neither side ever
+// waits for the other: frames not taken in time are replaced by newer ones.
+template<typename T>
+class TripleBuffer {
+
+  // Bit of middle set when it holds a buffer not consumed yet
+  static const uint8_t FRESH = 0x4;
+
+  T buffers[3];
+
+  // Buffer owned by the producer, and buffer owned by the consumer
+  uint8_t back;
+  uint8_t front;
+
+  // Buffer exchanged between the two sides
+  std::atomic<uint8_t> middle;
+
+public:
+  TripleBuffer();
+  T*   write_buffer();
+  void publish();
+  bool consume();
+  T*   read_buffer();
+};
+
+// Queue of N elements at most, N being a power of 2, shared by
+// one producer and one consumer, with no lock. Each side only writes
+// its own index: the producer never waits, and drops what it pushes
+// while the queue is full.
+template<typename T, uint32_t N>
+class SpscQueue {
+  static_assert((N & (N - 1)) == 0, "The size of the queue has to be a power of 2");
+
+  T items[N];
+
+  // Next element to pop, written by the consumer,
+  // and next element to push, written by the producer
+  alignas(64) std::atomic<uint32_t> head;
+  alignas(64) std::atomic<uint32_t> tail;
+
+public:
+  SpscQueue();
+  bool push(const T&);
+  bool peek(T*);
+  void pop();
+};
+
+// Distribution of the latencies from the draw of a frame to its presentation
+class LatencyStats {
+  uint64_t count;
+  uint64_t replaced;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[LATENCY_BUCKETS];
+
+public:
+            LatencyStats();
+  void      add(std::chrono::steady_clock::duration, uint64_t);
+  uint64_t  percentile(double);
+  void      report();
+};
+
+/** TripleBuffer::TripleBuffer
+    Constructor of the class.
+
+*/
+template<typename T>
+TripleBuffer<T>::TripleBuffer() : back(0), front(1), middle(2) {}
+
+/** TripleBuffer::write_buffer
+    Get the buffer to fill, owned by the producer until published.
+
+    @return T* buffer to fill
+*/
+template<typename T>
+inline T* TripleBuffer<T>::write_buffer(){
+  return &this->buffers[this->back];
+}
+
+/** TripleBuffer::publish
+    Hand the filled buffer to the consumer, replacing the
+    one published before if it was not consumed yet.
+
+*/
+template<typename T>
+inline void TripleBuffer<T>::publish(){
+  this->back = this->middle.exchange(this->back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+}
+
+/** TripleBuffer::consume
+    Take the last buffer published, if any since the previous call.
+
+    @return bool whether read_buffer holds a new buffer
+*/
+template<typename T>
+inline bool TripleBuffer<T>::consume(){
+  if(!(this->middle.load(std::memory_order_relaxed) & FRESH)) return false;
+
+  this->front = this->middle.exchange(this->front, std::memory_order_acq_rel) & ~FRESH;
+  return true;
+}
+
+/** TripleBuffer::read_buffer
+    Get the buffer taken by the last successful call to consume.
+
+    @return T* buffer owned by the consumer
+*/
+template<typename T>
+inline T* TripleBuffer<T>::read_buffer(){
+  return &this->buffers[this->front];
+}
+
+/** SpscQueue::SpscQueue
+    Constructor of the class.
+
+*/
+template<typename T, uint32_t N>
+SpscQueue<T, N>::SpscQueue() : head(0), tail(0) {}
+
+/** SpscQueue::push
+    Add an element at the end of the queue. Producer side only.
+
+    @param item const T& element to add
+    @return bool whether it was added, false if the queue is full
+*/
+template<typename T, uint32_t N>
+inline bool SpscQueue<T, N>::push(const T& item){
+  uint32_t tail = this->tail.load(std::memory_order_relaxed);
+  if(tail - this->head.load(std::memory_order_acquire) == N) return false;
+
+  this->items[tail % N] = item;
+  this->tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+/** SpscQueue::peek
+    Read the first element of the queue, leaving it there.
+    Consumer side only.
+
+    @param item T* where to copy the element
+    @return bool whether there was an element, false if the queue is empty
+*/
+template<typename T, uint32_t N>
+inline bool SpscQueue<T, N>::peek(T* item){
+  uint32_t head = this->head.load(std::memory_order_relaxed);
+  if(head == this->tail.load(std::memory_order_acquire)) return false;
+
+  *item = this->items[head % N];
+  return true;
+}
+
+/** SpscQueue::pop
+    Remove the first element of the queue, read by a successful
+    call to peek. Consumer side only.
+
+*/
+template<typename T, uint32_t N>
+inline void SpscQueue<T, N>::pop(){
+  this->head.store(this->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+#endif // !__PIPELINE_H
@@ -0,0 +1,204 @@
+#include "profile.h"
+
+#ifdef CHIP8_PROFILE
+
+#include "chip8.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+thread_local Profiler profiler;
+
+// Names of the opcodes, in the same order as chip8_opcode
+static const char* const opcode_names[OP_COUNT] = {
+  "invalid",
+  "00E0 CLS",  "00EE RET",  "1nnn JP",   "2nnn CALL",
+  "3xkk SE",   "4xkk SNE",  "5xy0 SE",   "6xkk LD",
+  "7xkk ADD",  "8xy0 LD",   "8xy1 OR",   "8xy2 AND",
+  "8xy3 XOR",  "8xy4 ADD",  "8xy5 SUB",  "8xy6 SHR",
+  "8xy7 SUBN", "8xyE SHL",  "9xy0 SNE",  "Annn LD",
+  "Bnnn JP",   "Cxkk RND",  "Dxyn DRW",  "Ex9E SKP",
+  "ExA1 SKNP", "Fx07 LD",   "Fx0A LD",   "Fx15 LD",
+  "Fx18 LD",   "Fx1E ADD",  "Fx29 LD",   "Fx33 LD",
+  "Fx55 LD",   "Fx65 LD",
+  "00Cn SCD",  "00Dn SCU",  "00FB SCR",  "00FC SCL",
+  "00FD EXIT", "00FE LOW",  "00FF HIGH", "5xy2 LD",
+  "5xy3 LD",   "F000 LD",   "Fn01 PLANE", "Fx30 LD",
+  "Fx75 LD",   "Fx85 LD",   "F002 LD",   "Fx3A PITCH",
+};
+
+// Names of the sections, in the same order as profile_section
+static const char* const section_names[PROFILE_SECTIONS] = {
+  "Dxyn draw", "display update", "input polling",
+};
+
+// Lines of the report for the addresses executed most
+#define PROFILE_TOP_ADDRESSES 20
+
+/** Profiler::Profiler
+    Constructor of the class. All the counters start from 0.
+
+*/
+Profiler::Profiler(){
+
+  for(int i = 0; i < 256; i++)  this->opcodes[i] = 0;
+  this->addresses.assign(DATA_MEMORY_SIZE, 0);
+
+  for(int i = 0; i < PROFILE_SECTIONS; i++){
+    this->section_calls[i] = 0;
+    this->section_time[i] = 0;
+  }
+
+  // Root of the call tree
+  this->parents.push_back(0);
+  this->targets.push_back(0);
+  this->counts.push_back(0);
+  this->node = 0;
+}
+
+/** Profiler::instruction
+    Count an instruction, and follow the calls and returns.
+
+    @param d  const chip8_decoded* instruction executed
+    @param pc uint16_t address of the instruction
+*/
+void Profiler::instruction(const chip8_decoded* d, uint16_t pc){
+
+  this->opcodes[d->op]++;
+  this->addresses[pc]++;
+  this->counts[this->node]++;
+
+  if(d->op == OP_2nnn_CALL){
+    auto key = std::make_pair(this->node, d->nnn);
+    auto child = this->children.find(key);
+
+    if(child == this->children.end()){
+      uint32_t id = this->parents.size();
+      this->parents.push_back(this->node);
+      this->targets.push_back(d->nnn);
+      this->counts.push_back(0);
+      child = this->children.emplace(key, id).first;
+    }
+
+    this->node = child->second;
+  }
+  else if(d->op == OP_00EE_RET){
+    this->node = this->parents[this->node];
+  }
+}
+
+/** Profiler::section
+    Add the time spent in a section.
+
+    @param section     profile_section section timed
+    @param nanoseconds uint64_t time spent in it
+*/
+void Profiler::section(profile_section section, uint64_t nanoseconds){
+  this->section_calls[section]++;
+  this->section_time[section] += nanoseconds;
+}
+
+/** Profiler::stack_name
+    Get the call stack of a node of the call tree, as the names
+    of the subroutines from the outermost, separated by ';'.
+
+    @param node uint32_t node of the call tree
+    @return string the call stack
+*/
+std::string Profiler::stack_name(uint32_t node){
+
+  if(node == 0) return "main";
+
+  char name[16];
+  snprintf(name, sizeof(name), ";sub_%03x", this->targets[node]);
+  return this->stack_name(this->parents[node]) + name;
+}
+
+/** Profiler::report
+    Print the instructions executed by opcode and by address,
+    most executed first, and the time spent in each section.
+
+*/
+void Profiler::report(){
+
+  uint64_t total = 0;
+  for(int i = 0; i < OP_COUNT; i++) total += this->opcodes[i];
+  if(total == 0) total = 1;
+
+  char line[128];
+  std::cerr << "instructions by opcode" << std::endl;
+
+  std::vector<int> ops;
+  for(int i = 0; i < OP_COUNT; i++) if(this->opcodes[i]) ops.push_back(i);
+  std::sort(ops.begin(), ops.end(), [this](int a, int b){ return this->opcodes[a] > this->opcodes[b]; });
+
+  for(int op : ops){
+    snprintf(line, sizeof(line), "  %-10s %14llu %6.2f%%", opcode_names[op],
+             (unsigned long long) this->opcodes[op], 100.0 * this->opcodes[op] / total);
+    std::cerr << line << std::endl;
+  }
+
+  std::cerr << "instructions by address" << std::endl;
+
+  std::vector<int> pcs;
+  for(int i = 0; i < DATA_MEMORY_SIZE; i++) if(this->addresses[i]) pcs.push_back(i);
+  std::sort(pcs.begin(), pcs.end(), [this](int a, int b){ return this->addresses[a] > this->addresses[b]; });
+
+  for(size_t i = 0; i < pcs.size() && i < PROFILE_TOP_ADDRESSES; i++){
+    snprintf(line, sizeof(line), "  %04x       %14llu %6.2f%%", pcs[i],
+             (unsigned long long) this->addresses[pcs[i]], 100.0 * this->addresses[pcs[i]] / total);
+    std::cerr << line << std::endl;
+  }
+
+  std::cerr << "time by section" << std::endl;
+
+  for(int i = 0; i < PROFILE_SECTIONS; i++){
+    if(!this->section_calls[i]) continue;
+
+    snprintf(line, sizeof(line), "  %-15s %10llu calls %12.3f ms %10.0f ns/call", section_names[i],
+             (unsigned long long) this->section_calls[i], this->section_time[i] / 1e6,
+             (double) this->section_time[i] / this->section_calls[i]);
+    std::cerr << line << std::endl;
+  }
+}
+
+/** Profiler::write_folded
+    Write the instructions executed in each call stack, in the folded
+    format read by flamegraph.pl: one line per stack, with the frames
+    separated by ';' and followed by the count.
+
+    @param file_name string name of the file to write
+*/
+void Profiler::write_folded(std::string file_name){
+
+  std::ofstream file(file_name);
+  if(!file){
+    throw std::invalid_argument("Profile file not opened correctly");
+  }
+
+  for(uint32_t n = 0; n < this->counts.size(); n++)
+    if(this->counts[n]) file << this->stack_name(n) << " " << this->counts[n] << "\n";
+}
+
+/** ProfileScope::ProfileScope
+    Start timing a section.
+
+    @param section profile_section section to time
+*/
+ProfileScope::ProfileScope(profile_section section){
+  this->section = section;
+  this->start = std::chrono::steady_clock::now();
+}
+
+/** ProfileScope::~ProfileScope
+    Stop timing the section, and add the time to the profiler.
+
+*/
+ProfileScope::~ProfileScope(){
+  auto time = std::chrono::steady_clock::now() - this->start;
+  profiler.section(this->section, std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+// Instrumentation of the emulator, built only with CHIP8_PROFILE defined.
+// Without it, the macros below expand to nothing, and the interpreter
+// is the same as if they were not there.
+//
+//    CHIP8_PROFILE_INSTRUCTION(d, pc)  count an instruction executed at pc
+//    CHIP8_PROFILE_SCOPE(section)      time the rest of the enclosing block
+//    CHIP8_PROFILE_DUMP(file)          print the report on the standard error,
+//                                      and write the folded stacks in file
+//    CHIP8_PROFILE_REPORT()            only print the report, e.g. of a thread
+//                                      which runs no instructions
+#ifdef CHIP8_PROFILE
+
+#include <stdint.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct chip8_decoded;
+
+// Parts of the emulator timed by the profiler
+enum profile_section : uint8_t {
+  PROFILE_DRAW = 0,
+  PROFILE_DISPLAY,
+  PROFILE_INPUT,
+  PROFILE_SECTIONS
+};
+
+// Counts of the instructions executed, by opcode, by address and by
+// call stack, the stack being followed through 2nnn and 00EE; and time
+// spent in each section. Each thread has its own profiler.
+class Profiler {
+
+  uint64_t opcodes[256];
+  std::vector<uint64_t> addresses;
+
+  uint64_t section_calls[PROFILE_SECTIONS];
+  uint64_t section_time[PROFILE_SECTIONS];
+
+  // Node n of the call tree is a call to targets[n] from parents[n],
+  // node 0 being the root, and counts the instructions executed in it
+  std::vector<uint32_t> parents;
+  std::vector<uint16_t> targets;
+  std::vector<uint64_t> counts;
+  std::map<std::pair<uint32_t, uint16_t>, uint32_t> children;
+  uint32_t node;
+
+  std::string stack_name(uint32_t);
+
+public:
+        Profiler();
+  void  instruction(const chip8_decoded*, uint16_t);
+  void  section(profile_section, uint64_t);
+  void  report();
+  void  write_folded(std::string);
+};
+
+// Timer of a section, from its construction to its destruction
+class ProfileScope {
+  profile_section section;
+  std::chrono::steady_clock::time_point start;
+
+public:
+  ProfileScope(profile_section);
+  ~ProfileScope();
+};
+
+extern thread_local Profiler profiler;
+
+#define CHIP8_PROFILE_CONCAT(a, b)        a##b
+#define CHIP8_PROFILE_NAME(line)          CHIP8_PROFILE_CONCAT(profile_scope_, line)
+
+#define CHIP8_PROFILE_INSTRUCTION(d, pc)  profiler.instruction(d, pc)
+#define CHIP8_PROFILE_SCOPE(section)      ProfileScope CHIP8_PROFILE_NAME(__LINE__)(section)
+#define CHIP8_PROFILE_DUMP(file)          (profiler.report(), profiler.write_folded(file))
+#define CHIP8_PROFILE_REPORT()            profiler.report()
+
+#else
+
+#define CHIP8_PROFILE_INSTRUCTION(d, pc)
+#define CHIP8_PROFILE_SCOPE(section)
+#define CHIP8_PROFILE_DUMP(file)
+#define CHIP8_PROFILE_REPORT()
+
+#endif
+
+#endif // !__PROFILE_H
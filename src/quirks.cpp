@@ -0,0 +1,97 @@
+#include "quirks.h"
+#include "memory.h"
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+// Names of the profiles, in the order of chip8_quirks
+static const char* const quirks_names[QUIRKS_COUNT] = {
+  "legacy", "vip", "schip", "modern"
+};
+
+/** quirks_from_name
+    Get the profile with a given name.
+
+    @param name string legacy, vip, schip or modern
+    @return uint8_t chip8_quirks of the profile
+*/
+uint8_t quirks_from_name(std::string name){
+
+  for(int i = 0; i < QUIRKS_COUNT; i++)
+    if(name == quirks_names[i]) return i;
+
+  throw std::invalid_argument("Quirks profile not valid: " + name);
+}
+
+/** quirks_name
+    Get the name of a profile.
+
+    @param quirks uint8_t chip8_quirks of the profile
+    @return string name of the profile
+*/
+std::string quirks_name(uint8_t quirks){
+
+  if(quirks >= QUIRKS_COUNT){
+    throw std::invalid_argument("Quirks profile not valid");
+  }
+
+  return quirks_names[quirks];
+}
+
+/** quirks_from_database
+    Look for the profile of a rom in a database. Each line of the
+    database is made of the FNV-1a hash of a rom in hexadecimal and
+    the name of its profile, optionally followed by the name of the rom;
+    lines starting with # are comments.
+
+    @param rom      string name of the rom file
+    @param database string name of the database file
+    @param quirks   uint8_t* where to store the chip8_quirks of the rom, if found
+    @return bool whether the rom is in the database
+*/
+bool quirks_from_database(std::string rom, std::string database, uint8_t* quirks){
+
+  std::ifstream rom_file(rom, std::ios::binary);
+  if(!rom_file){
+    throw std::invalid_argument("Rom not opened correctly");
+  }
+
+  std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(rom_file)), std::istreambuf_iterator<char>());
+
+  uint64_t h = FNV_OFFSET;
+  for(uint8_t byte : bytes){
+    h ^= byte;
+    h *= FNV_PRIME;
+  }
+
+  std::ifstream file(database);
+  if(!file){
+    throw std::invalid_argument("Quirks database not opened correctly");
+  }
+
+  std::string line;
+
+  while(std::getline(file, line)){
+
+    // Skip comments and empty lines
+    size_t first = line.find_first_not_of(" \t\r");
+    if(first == std::string::npos || line[first] == '#') continue;
+
+    std::istringstream fields(line);
+    uint64_t hash;
+    std::string name;
+
+    if(!(fields >> std::hex >> hash >> name)){
+      throw std::invalid_argument("Quirks database line not valid: " + line);
+    }
+
+    if(hash == h){
+      *quirks = quirks_from_name(name);
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,68 @@
+#ifndef __QUIRKS_H
+#define __QUIRKS_H
+
+#include <stdint.h>
+#include <string>
+
+// Behaviors which differ between the interpreters of CHIP-8.
+// Each profile is a type with the choices as compile time constants,
+// and the interpreter is instantiated once per profile, so that the
+// choices cost no branch when the instructions are executed:
+//
+//    shift_vy        8xy6 and 8xyE shift Vy into Vx, instead of Vx in place
+//    memory_moves_i  Fx55 and Fx65 leave I after the last register
+//    jump_vx         Bxnn jumps to xnn + Vx, instead of nnn + V0
+//    sprites_clip    sprites are cut at the edges of the screen, instead of wrapping
+//    logic_resets_vf 8xy1, 8xy2 and 8xy3 set VF to 0
+
+// Behavior of this emulator before the profiles existed, kept as default
+// so that recordings, snapshots and hashes stay valid
+struct quirks_legacy {
+  static constexpr bool shift_vy        = false;
+  static constexpr bool memory_moves_i  = false;
+  static constexpr bool jump_vx         = false;
+  static constexpr bool sprites_clip    = false;
+  static constexpr bool logic_resets_vf = false;
+};
+
+// Original interpreter of the COSMAC VIP
+struct quirks_vip {
+  static constexpr bool shift_vy        = true;
+  static constexpr bool memory_moves_i  = true;
+  static constexpr bool jump_vx         = false;
+  static constexpr bool sprites_clip    = true;
+  static constexpr bool logic_resets_vf = true;
+};
+
+// SUPER-CHIP 1.1 on the HP 48
+struct quirks_schip {
+  static constexpr bool shift_vy        = false;
+  static constexpr bool memory_moves_i  = false;
+  static constexpr bool jump_vx         = true;
+  static constexpr bool sprites_clip    = true;
+  static constexpr bool logic_resets_vf = false;
+};
+
+// Modern interpreters, as Octo and XO-CHIP
+struct quirks_modern {
+  static constexpr bool shift_vy        = true;
+  static constexpr bool memory_moves_i  = true;
+  static constexpr bool jump_vx         = false;
+  static constexpr bool sprites_clip    = false;
+  static constexpr bool logic_resets_vf = false;
+};
+
+// Identifiers of the profiles, to select one at run time
+enum chip8_quirks : uint8_t {
+  QUIRKS_LEGACY = 0,
+  QUIRKS_VIP,
+  QUIRKS_SCHIP,
+  QUIRKS_MODERN,
+  QUIRKS_COUNT
+};
+
+uint8_t     quirks_from_name(std::string);
+std::string quirks_name(uint8_t);
+bool        quirks_from_database(std::string, std::string, uint8_t*);
+
+#endif // !__QUIRKS_H
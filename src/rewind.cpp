@@ -0,0 +1,172 @@
+#include "rewind.h"
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+
+/** Rewind::Rewind
+    Constructor of the class.
+
+    @param max_frames size_t maximum number of frames to keep
+    @param bytes      size_t bytes of the ring storing the deltas
+*/
+Rewind::Rewind(size_t max_frames, size_t bytes) : ring(bytes) {
+
+  if(max_frames == 0 || bytes == 0){
+    throw std::invalid_argument("Rewind history cannot be empty");
+  }
+
+  this->max_frames = max_frames;
+  this->clear();
+}
+
+/** Rewind::clear
+    Drop the whole history.
+
+*/
+void Rewind::clear(){
+  this->head = 0;
+  this->used = 0;
+  this->frames.clear();
+  this->has_last = false;
+  this->last_key = 0;
+}
+
+/** Rewind::drop_oldest
+    Drop the oldest frame of the ring.
+
+*/
+void Rewind::drop_oldest(){
+  this->used -= this->frames.front().size;
+  this->frames.pop_front();
+}
+
+/** Rewind::capture
+    Record the state of a machine at the start of a frame.
+    The previous frame is moved into the ring as a delta.
+
+    @param machine Machine* machine to record
+    @param key     uint16_t keys pressed during the frame
+*/
+void Rewind::capture(Machine* machine, uint16_t key){
+
+  machine->save(&this->current);
+
+  if(this->has_last){
+    this->last.delta(this->current, &this->delta);
+
+    size_t size = this->delta.size();
+
+    // Nothing ran since the last frame, e.g. right after going back
+    if(size == 0){
+      this->last_key = key;
+      return;
+    }
+
+    size_t capacity = this->ring.size();
+
+    if(size > capacity){
+
+      // The delta does not fit at all, the history starts again from here
+      this->head = 0;
+      this->used = 0;
+      this->frames.clear();
+    }
+    else {
+      while(this->used + size > capacity || this->frames.size() == this->max_frames)
+        this->drop_oldest();
+
+      // Copy the delta at the head of the ring, wrapping around its end
+      size_t first = std::min(size, capacity - this->head);
+      memcpy(&this->ring[this->head], this->delta.data(), first);
+      memcpy(&this->ring[0], this->delta.data() + first, size - first);
+
+      this->frames.push_back({ this->head, size, this->last_key });
+      this->head = (this->head + size) % capacity;
+      this->used += size;
+    }
+  }
+
+  std::swap(this->last, this->current);
+  this->last_key = key;
+  this->has_last = true;
+}
+
+/** Rewind::back_frame
+    Move a machine back to the start of the frame before the last
+    captured one, which becomes the last captured frame.
+
+    @param machine Machine* machine to move back
+    @return bool false if there is no older frame
+*/
+bool Rewind::back_frame(Machine* machine){
+
+  if(this->frames.empty()) return false;
+
+  frame f = this->frames.back();
+  size_t capacity = this->ring.size();
+
+  // Copy the delta out of the ring, it can wrap around its end
+  size_t first = std::min(f.size, capacity - f.offset);
+  this->delta.resize(f.size);
+  memcpy(this->delta.data(), &this->ring[f.offset], first);
+  memcpy(this->delta.data() + first, &this->ring[0], f.size - first);
+
+  this->last.apply(this->delta.data(), f.size);
+  this->last_key = f.key;
+
+  this->frames.pop_back();
+  this->head = f.offset;
+  this->used -= f.size;
+
+  machine->restore(this->last);
+  return true;
+}
+
+/** Rewind::back_instruction
+    Move a machine back by one instruction. The machine goes back to
+    the start of the frame of that instruction, and runs again up to it
+    with the keys of the frame. The machine must have been run with the
+    keys given to capture since the last captured frame.
+
+    @param machine Machine* machine to move back
+    @return bool false if the history does not reach that instruction
+*/
+bool Rewind::back_instruction(Machine* machine){
+
+  if(!this->has_last) return false;
+
+  uint64_t target = machine->get_cycle();
+  if(target == 0) return false;
+  target--;
+
+  uint64_t start = Machine::snapshot_cycle(this->last);
+
+  // The instruction is in an older frame
+  if(target < start){
+    if(!this->back_frame(machine)) return false;
+    start = Machine::snapshot_cycle(this->last);
+  }
+  else machine->restore(this->last);
+
+  machine->set_key(this->last_key);
+  machine->run(target - start);
+  return true;
+}
+
+/** Rewind::get_frames
+    Return the number of frames the machine can go back
+
+    @return size_t number of frames in the history
+*/
+size_t Rewind::get_frames(){
+  return this->frames.size();
+}
+
+/** Rewind::get_bytes
+    Return the bytes of the ring used by the history
+
+    @return size_t bytes used
+*/
+size_t Rewind::get_bytes(){
+  return this->used;
+}
@@ -0,0 +1,59 @@
+#ifndef __REWIND_H
+#define __REWIND_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include "machine.h"
+#include "snapshot.h"
+
+// Default length of the history, in frames, and memory it can use
+#define REWIND_FRAMES 600
+#define REWIND_BYTES  (4 * 1024 * 1024)
+
+// History of the last frames of a machine, to go back in time.
+// The state at the start of each frame is captured; only the most
+// recent one is kept whole, the older ones are stored as the deltas
+// between consecutive frames (see Snapshot::delta) in a ring of bytes
+// of fixed size. When the ring or the number of frames is full,
+// the oldest frames are dropped.
+class Rewind {
+
+  // Frame stored in the ring: the delta going back to its start,
+  // with the keys pressed during the frame
+  struct frame {
+    size_t   offset;
+    size_t   size;
+    uint16_t key;
+  };
+
+  std::vector<uint8_t> ring;
+  size_t               head;
+  size_t               used;
+
+  std::deque<frame>    frames;
+  size_t               max_frames;
+
+  // State at the start of the last frame, with its keys
+  Snapshot             last;
+  uint16_t             last_key;
+  bool                 has_last;
+
+  // Scratch space for the snapshots and deltas
+  Snapshot             current;
+  std::vector<uint8_t> delta;
+
+  void drop_oldest();
+
+public:
+            Rewind(size_t = REWIND_FRAMES, size_t = REWIND_BYTES);
+  void      clear();
+  void      capture(Machine*, uint16_t);
+  bool      back_frame(Machine*);
+  bool      back_instruction(Machine*);
+  size_t    get_frames();
+  size_t    get_bytes();
+};
+
+#endif // !__REWIND_H
@@ -0,0 +1,122 @@
+#include "scheduler.h"
+#include "chip8.h"
+#include <stdexcept>
+#include <thread>
+
+// Time before a deadline which is waited spinning instead of sleeping
+#define SPIN_TIME std::chrono::microseconds(1000)
+
+// Slices after which a late scheduler gives up catching up
+#define MAX_LATE_SLICES 5
+
+/** Scheduler::Scheduler
+    Constructor of the class.
+
+    @param ips uint64_t instructions executed in a second
+*/
+Scheduler::Scheduler(uint64_t ips){
+
+  if(ips == 0){
+    throw std::invalid_argument("Instructions per second cannot be 0");
+  }
+
+  this->ips = ips;
+  this->uncapped = false;
+  this->slice = 0;
+  this->cycles = 0;
+  this->start = clock::now();
+  this->waited = 0;
+  this->next_frame = this->start;
+}
+
+/** Scheduler::slice_time
+    Get the host time taken by a number of slices,
+    computed from the start so that no rounding error accumulates.
+
+    @param count uint64_t number of slices
+    @return clock::duration time of the slices
+*/
+Scheduler::clock::duration Scheduler::slice_time(uint64_t count){
+  return std::chrono::duration_cast<clock::duration>(
+           std::chrono::nanoseconds(count * 1000000000ULL / TIMER_HZ));
+}
+
+/** Scheduler::set_uncapped
+    Run the slices as fast as possible, instead of at 60 Hz.
+
+    @param uncapped bool whether to ignore the speed of the CPU
+*/
+void Scheduler::set_uncapped(bool uncapped){
+  this->uncapped = uncapped;
+}
+
+/** Scheduler::slice_cycles
+    Get the number of instructions of the next slice.
+    The slices do not all have the same length when ips is not a
+    multiple of 60, so that every second has exactly ips instructions.
+
+    @return uint64_t number of instructions to execute
+*/
+uint64_t Scheduler::slice_cycles(){
+
+  this->slice++;
+  uint64_t end = this->slice * this->ips / TIMER_HZ;
+  uint64_t count = end - this->cycles;
+
+  this->cycles = end;
+  return count;
+}
+
+/** Scheduler::frame_due
+    Check whether a frame has to be presented after the current slice.
+    This is always the case at normal speed; when uncapped, frames are
+    presented at 60 Hz of host time.
+
+    @return bool whether to present a frame
+*/
+bool Scheduler::frame_due(){
+
+  if(!this->uncapped) return true;
+
+  clock::time_point now = clock::now();
+  if(now < this->next_frame) return false;
+
+  this->next_frame = now + this->slice_time(1);
+  return true;
+}
+
+/** Scheduler::wait
+    Wait for the start of the next slice. Most of the time is slept,
+    the end is waited spinning, since sleeps can be much longer than
+    requested. If the host is too slow to keep up, the missed slices
+    are dropped instead of being run back to back.
+    When the CPU is idle the whole time is slept, since being late
+    by the wake up time of the host does not change what it does.
+
+    @param idle bool whether the CPU ended the slice in an idle loop
+*/
+void Scheduler::wait(bool idle){
+
+  if(this->uncapped) return;
+
+  this->waited++;
+
+  clock::time_point next = this->start + this->slice_time(this->waited);
+  clock::time_point now = clock::now();
+
+  // Too late, start pacing again from now
+  if(now > next + this->slice_time(MAX_LATE_SLICES)){
+    this->start = now;
+    this->waited = 0;
+    return;
+  }
+
+  if(idle){
+    std::this_thread::sleep_until(next);
+    return;
+  }
+
+  if(next - now > SPIN_TIME) std::this_thread::sleep_until(next - SPIN_TIME);
+
+  while(clock::now() < next);
+}
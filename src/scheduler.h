@@ -0,0 +1,39 @@
+#ifndef __SCHEDULER_H
+#define __SCHEDULER_H
+
+#include <stdint.h>
+#include <chrono>
+
+// Paces the emulation on the host clock. Time is split in slices
+// of 1/60 s: in each slice the CPU executes its share of instructions,
+// the timers tick once and a frame is presented. When uncapped, the
+// slices are run back to back, and frames are still presented at most
+// 60 times per second of host time.
+class Scheduler {
+  typedef std::chrono::steady_clock clock;
+
+  uint64_t ips;
+  bool     uncapped;
+
+  // Slices run so far, and instructions given to them
+  uint64_t slice;
+  uint64_t cycles;
+
+  // Host time from which the slices are paced, and slices waited since then
+  clock::time_point start;
+  uint64_t          waited;
+
+  // Host time at which the next frame is due when uncapped
+  clock::time_point next_frame;
+
+  clock::duration   slice_time(uint64_t);
+
+public:
+            Scheduler(uint64_t);
+  void      set_uncapped(bool);
+  uint64_t  slice_cycles();
+  bool      frame_due();
+  void      wait(bool);
+};
+
+#endif // !__SCHEDULER_H
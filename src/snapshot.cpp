@@ -0,0 +1,234 @@
+#include "snapshot.h"
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+
+/** Snapshot::Snapshot
+    Constructor of the class. The snapshot starts empty.
+
+*/
+Snapshot::Snapshot(){
+}
+
+/** Snapshot::resize
+    Set the size of the image. The content is kept, up to the new size.
+
+    @param size size_t number of bytes of the image
+*/
+void Snapshot::resize(size_t size){
+  this->image.resize(size);
+}
+
+/** Snapshot::data
+    Return the bytes of the image
+
+    @return uint8_t* first byte of the image
+*/
+uint8_t* Snapshot::data(){
+  return this->image.data();
+}
+
+/** Snapshot::data
+    Return the bytes of the image
+
+    @return const uint8_t* first byte of the image
+*/
+const uint8_t* Snapshot::data() const {
+  return this->image.data();
+}
+
+/** Snapshot::size
+    Return the size of the image
+
+    @return size_t number of bytes of the image
+*/
+size_t Snapshot::size() const {
+  return this->image.size();
+}
+
+/** put_number
+    Write a number as LEB128, 7 bits per byte, least significant first.
+
+    @param out   std::vector<uint8_t>* where to append the number
+    @param value uint64_t number to write
+*/
+static void put_number(std::vector<uint8_t>* out, uint64_t value){
+  while(value >= 0x80){
+    out->push_back((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out->push_back(value);
+}
+
+/** get_number
+    Read a number written by put_number.
+
+    @param in  const uint8_t** next byte to read, moved after the number
+    @param end const uint8_t* end of the data
+    @return uint64_t number read
+*/
+static uint64_t get_number(const uint8_t** in, const uint8_t* end){
+
+  uint64_t value = 0;
+
+  for(int shift = 0; *in < end && shift < 64; shift += 7){
+    uint8_t byte = *(*in)++;
+    value |= (uint64_t) (byte & 0x7f) << shift;
+    if(!(byte & 0x80)) return value;
+  }
+
+  throw std::invalid_argument("Snapshot delta not valid");
+}
+
+/** Snapshot::delta
+    Compute the delta between this snapshot and another one
+    of the same size.
+
+    @param other const Snapshot& snapshot to compare with
+    @param out   std::vector<uint8_t>* where to write the delta
+*/
+void Snapshot::delta(const Snapshot& other, std::vector<uint8_t>* out) const {
+
+  if(other.size() != this->size()){
+    throw std::invalid_argument("Snapshots of different sizes");
+  }
+
+  const uint8_t* a = this->data();
+  const uint8_t* b = other.data();
+  size_t size = this->size();
+  size_t last = 0;
+  size_t i = 0;
+
+  out->clear();
+
+  while(i < size){
+
+    // Skip the bytes which did not change, 8 at a time when possible
+    while(i + 8 <= size && memcmp(a + i, b + i, 8) == 0) i += 8;
+    while(i < size && a[i] == b[i]) i++;
+    if(i == size) break;
+
+    // Find the end of the changed run; short equal gaps are kept
+    // in the run, since a new record would cost more
+    size_t end = i + 1;
+    while(end < size){
+      if(a[end] != b[end]) end++;
+      else if(end + 2 < size && (a[end + 1] != b[end + 1] || a[end + 2] != b[end + 2])) end++;
+      else break;
+    }
+
+    put_number(out, i - last);
+    put_number(out, end - i);
+    for(size_t j = i; j < end; j++) out->push_back(a[j] ^ b[j]);
+
+    last = i = end;
+  }
+}
+
+/** Snapshot::apply
+    Apply a delta computed by Snapshot::delta to this snapshot,
+    turning one of the two snapshots into the other one.
+
+    @param delta const uint8_t* bytes of the delta
+    @param size  size_t number of bytes of the delta
+*/
+void Snapshot::apply(const uint8_t* delta, size_t size){
+
+  const uint8_t* end = delta + size;
+  size_t pos = 0;
+
+  while(delta < end){
+    pos += get_number(&delta, end);
+    uint64_t count = get_number(&delta, end);
+
+    if(pos + count > this->size() || count > (uint64_t) (end - delta)){
+      throw std::invalid_argument("Snapshot delta not valid");
+    }
+
+    for(uint64_t j = 0; j < count; j++) this->image[pos + j] ^= *delta++;
+    pos += count;
+  }
+}
+
+/** Snapshot::save_file
+    Write the snapshot to a file.
+
+    @param file_name string name of the file to write
+*/
+void Snapshot::save_file(std::string file_name) const {
+
+  std::ofstream file(file_name, std::ios::out | std::ios::binary);
+  if(!file){
+    throw std::invalid_argument("Snapshot file not opened correctly");
+  }
+
+  uint8_t header[10] = { 'C', '8', 'S', 'S' };
+  put(put(header + 4, SNAPSHOT_VERSION, 2), this->size(), 4);
+
+  file.write((const char*) header, sizeof(header));
+  file.write((const char*) this->data(), this->size());
+
+  if(!file){
+    throw std::invalid_argument("Snapshot file not written correctly");
+  }
+}
+
+/** Snapshot::load_file
+    Read a snapshot written by Snapshot::save_file.
+
+    @param file_name string name of the file to read
+*/
+void Snapshot::load_file(std::string file_name){
+
+  std::ifstream file(file_name, std::ios::in | std::ios::binary);
+  if(!file){
+    throw std::invalid_argument("Snapshot file not opened correctly");
+  }
+
+  uint8_t header[10];
+  uint64_t version, size;
+
+  file.read((char*) header, sizeof(header));
+  if(!file || memcmp(header, "C8SS", 4) != 0){
+    throw std::invalid_argument("Not a snapshot file");
+  }
+
+  get(get(header + 4, &version, 2), &size, 4);
+  if(version != SNAPSHOT_VERSION){
+    throw std::invalid_argument("Snapshot version not supported");
+  }
+
+  this->image.resize(size);
+  file.read((char*) this->data(), size);
+
+  if(!file){
+    throw std::invalid_argument("Snapshot file truncated");
+  }
+}
+
+/** Snapshot::put
+    Write a number in an image, least significant byte first.
+
+    @param out   uint8_t* where to write
+    @param value uint64_t number to write
+    @param bytes int number of bytes to write
+    @return uint8_t* first byte after the number
+*/
+uint8_t* Snapshot::put(uint8_t* out, uint64_t value, int bytes){
+  for(int i = 0; i < bytes; i++) *out++ = value >> (8 * i);
+  return out;
+}
+
+/** Snapshot::get
+    Read a number written by Snapshot::put.
+
+    @param in    const uint8_t* where to read
+    @param value uint64_t* number read
+    @param bytes int number of bytes to read
+    @return const uint8_t* first byte after the number
+*/
+const uint8_t* Snapshot::get(const uint8_t* in, uint64_t* value, int bytes){
+  *value = 0;
+  for(int i = 0; i < bytes; i++) *value |= (uint64_t) *in++ << (8 * i);
+  return in;
+}
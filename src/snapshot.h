@@ -0,0 +1,41 @@
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Version of the layout of the state, written in the snapshot files
+#define SNAPSHOT_VERSION 3
+
+// State of a machine, saved as a flat image of bytes with a fixed layout
+// (see Machine::save), so that snapshots can be compared, hashed and
+// delta-encoded byte by byte.
+//
+// A delta is the XOR between two images, with the runs of equal bytes
+// skipped: it is a sequence of (skip, count, count bytes of XOR) records,
+// skip and count being LEB128 numbers. Since XOR is its own inverse,
+// the same delta turns either image into the other one.
+//
+// On disk a snapshot is the magic "C8SS", the version (2 bytes)
+// and the size of the image (4 bytes), little-endian, then the image.
+class Snapshot {
+  std::vector<uint8_t> image;
+
+public:
+                  Snapshot();
+  void            resize(size_t);
+  uint8_t*        data();
+  const uint8_t*  data() const;
+  size_t          size() const;
+  void            delta(const Snapshot&, std::vector<uint8_t>*) const;
+  void            apply(const uint8_t*, size_t);
+  void            save_file(std::string) const;
+  void            load_file(std::string);
+
+  static uint8_t*       put(uint8_t*, uint64_t, int);
+  static const uint8_t* get(const uint8_t*, uint64_t*, int);
+};
+
+#endif // !__SNAPSHOT_H
@@ -0,0 +1,107 @@
+#include "lockstep.h"
+#include "machine.h"
+#include "input_script.h"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+/** usage
+    Print how to use the program.
+
+*/
+void usage(){
+  std::cerr << "usage: chip8_sweep path_to_rom [options]\n"
+               "  --lanes N   machines to run in lockstep (default 256)\n"
+               "  --cycles N  instructions to execute (default 100000)\n"
+               "  --seed N    seed of the first machine, the others use the next ones (default 1)\n"
+               "  --keys FILE input script with the key events, the same for all the machines\n"
+               "  --verify    run each machine on its own as well, and compare the final states\n";
+}
+
+int main(int argc, char* argv[]){
+
+  if(argc < 2){
+    usage();
+    throw std::invalid_argument("Not enough arguments to run");
+  }
+
+  std::string rom = argv[1];
+  std::string keys;
+  size_t lanes = 256;
+  uint64_t cycles = 100000;
+  uint32_t seed = 1;
+  bool verify = false;
+
+  for(int i = 2; i < argc; i++){
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if     (arg == "--lanes"  && has_value) lanes = std::stoul(argv[++i]);
+    else if(arg == "--cycles" && has_value) cycles = std::stoull(argv[++i]);
+    else if(arg == "--seed"   && has_value) seed = std::stoul(argv[++i]);
+    else if(arg == "--keys"   && has_value) keys = argv[++i];
+    else if(arg == "--verify")              verify = true;
+    else {
+      usage();
+      throw std::invalid_argument("Argument not valid: " + arg);
+    }
+  }
+
+  chip8_lockstep lockstep(lanes);
+  InputScript script;
+
+  lockstep.load(rom, seed);
+
+  if(!keys.empty()){
+    script.init_from_file(keys);
+    lockstep.set_input(&script);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  lockstep.run(cycles);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  int mismatches = 0;
+
+  for(size_t i = 0; i < lanes; i++){
+    uint64_t hash = lockstep.hash(i);
+    char line[64];
+
+    snprintf(line, sizeof(line), "%lu %u %016llx", (unsigned long) i, (unsigned) (seed + i), (unsigned long long) hash);
+    std::cout << line;
+
+    // Same run on the scalar CPU
+    if(verify){
+      Machine machine;
+      InputScript lane_script;
+
+      machine.load(rom);
+      machine.set_seed(seed + i);
+
+      if(!keys.empty()){
+        lane_script.init_from_file(keys);
+        machine.set_input(&lane_script);
+      }
+
+      machine.run(cycles);
+
+      bool same = machine.hash() == hash;
+      if(!same) mismatches++;
+      std::cout << (same ? " ok" : " MISMATCH");
+    }
+
+    std::cout << std::endl;
+  }
+
+  uint64_t steps = lockstep.get_vector_steps() + lockstep.get_scalar_steps();
+
+  std::cerr << lanes << " lanes, " << cycles << " cycles, " << seconds << " s, "
+            << (uint64_t) (lanes * cycles / ((seconds > 0) ? seconds : 1e-9)) << " instructions/s, "
+            << (steps ? 100.0 * lockstep.get_vector_steps() / steps : 0) << "% vector steps" << std::endl;
+
+  if(verify) std::cerr << mismatches << " mismatches" << std::endl;
+
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+#include "thread_pool.h"
+
+/** ThreadPool::ThreadPool
+    Constructor of the class. Starts the workers.
+
+    @param size size_t number of workers, 0 to use one per core
+*/
+ThreadPool::ThreadPool(size_t size){
+
+  if(size == 0) size = std::thread::hardware_concurrency();
+  if(size == 0) size = 1;
+
+  this->next_queue = 0;
+  this->pending = 0;
+  this->running = true;
+
+  for(size_t i = 0; i < size; i++)
+    this->queues.emplace_back(new worker_queue());
+
+  for(size_t i = 0; i < size; i++)
+    this->threads.emplace_back(&ThreadPool::work, this, i);
+}
+
+/** ThreadPool::~ThreadPool
+    Destroyer of the class.
+    Waits for the submitted jobs, then stops the workers.
+
+*/
+ThreadPool::~ThreadPool(){
+
+  this->wait();
+
+  {
+    std::lock_guard<std::mutex> guard(this->wake_lock);
+    this->running = false;
+  }
+  this->wake.notify_all();
+
+  for(auto& thread : this->threads) thread.join();
+}
+
+/** ThreadPool::submit
+    Add a job to the pool. Jobs are spread over the
+    queues of the workers in round robin.
+    Jobs must not be submitted from the workers.
+
+    @param job function<void()> job to execute
+*/
+void ThreadPool::submit(std::function<void()> job){
+
+  worker_queue* queue = this->queues[this->next_queue].get();
+  this->next_queue = (this->next_queue + 1) % this->queues.size();
+
+  {
+    std::lock_guard<std::mutex> guard(this->wake_lock);
+    this->pending++;
+    std::lock_guard<std::mutex> queue_guard(queue->lock);
+    queue->jobs.push_back(std::move(job));
+  }
+  this->wake.notify_one();
+}
+
+/** ThreadPool::wait
+    Wait until all the submitted jobs are completed.
+
+*/
+void ThreadPool::wait(){
+  std::unique_lock<std::mutex> guard(this->done_lock);
+  this->done.wait(guard, [this]{ return this->pending == 0; });
+}
+
+/** ThreadPool::size
+    Return the number of workers
+
+    @return size_t number of workers
+*/
+size_t ThreadPool::size(){
+  return this->threads.size();
+}
+
+/** ThreadPool::take
+    Get a job for a worker: the first one of its own queue,
+    or the last one of another queue.
+
+    @param id  size_t index of the worker
+    @param job function<void()>& where to store the job
+    @return bool whether a job was found
+*/
+bool ThreadPool::take(size_t id, std::function<void()>& job){
+
+  size_t count = this->queues.size();
+
+  for(size_t i = 0; i < count; i++){
+    worker_queue* queue = this->queues[(id + i) % count].get();
+    std::lock_guard<std::mutex> guard(queue->lock);
+
+    if(queue->jobs.empty()) continue;
+
+    if(i == 0){
+      job = std::move(queue->jobs.front());
+      queue->jobs.pop_front();
+    }
+    else {
+      job = std::move(queue->jobs.back());
+      queue->jobs.pop_back();
+    }
+    return true;
+  }
+
+  return false;
+}
+
+/** ThreadPool::work
+    Loop of a worker: execute jobs until the pool is destroyed.
+
+    @param id size_t index of the worker
+*/
+void ThreadPool::work(size_t id){
+
+  std::function<void()> job;
+
+  while(true){
+
+    if(this->take(id, job)){
+      job();
+      job = nullptr;
+
+      if(--this->pending == 0){
+        std::lock_guard<std::mutex> guard(this->done_lock);
+        this->done.notify_all();
+      }
+      continue;
+    }
+
+    // Sleep until new jobs arrive
+    std::unique_lock<std::mutex> guard(this->wake_lock);
+    this->wake.wait(guard, [this, id]{
+      if(!this->running) return true;
+      for(auto& queue : this->queues){
+        std::lock_guard<std::mutex> queue_guard(queue->lock);
+        if(!queue->jobs.empty()) return true;
+      }
+      return false;
+    });
+
+    if(!this->running) return;
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef __THREAD_POOL_H
+#define __THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Pool of threads with work stealing: each worker has its own queue
+// of jobs, takes the next one from the front of it and, once empty,
+// steals from the back of the queues of the other workers.
+class ThreadPool {
+
+  struct worker_queue {
+    std::mutex lock;
+    std::deque<std::function<void()>> jobs;
+  };
+
+  std::vector<std::thread> threads;
+  std::vector<std::unique_ptr<worker_queue>> queues;
+
+  // Queue receiving the next submitted job
+  size_t next_queue;
+
+  // Jobs submitted and not completed yet
+  std::atomic<size_t> pending;
+  std::mutex done_lock;
+  std::condition_variable done;
+
+  // Whether the workers have to wait for jobs or stop
+  std::atomic<bool> running;
+  std::mutex wake_lock;
+  std::condition_variable wake;
+
+  bool take(size_t, std::function<void()>&);
+  void work(size_t);
+
+public:
+          ThreadPool(size_t);
+          ~ThreadPool();
+  void    submit(std::function<void()>);
+  void    wait();
+  size_t  size();
+};
+
+#endif // !__THREAD_POOL_H